@@ -0,0 +1,666 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_bench.cpp: Google Benchmark suite for QuadTree operations
+
+#include "quadtree.h"
+#include "quadtree_linear.h"
+#include "quadtree_sharded.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <random>
+#include <string>
+
+// global allocation counters, every allocation carries its size in a header
+// so live bytes can be tracked without sized deallocation
+namespace {
+    std::atomic<size_t> g_allocations(0);
+    std::atomic<size_t> g_live_bytes(0);
+
+    constexpr size_t kAllocHeader = alignof(std::max_align_t);
+
+    void* counted_alloc(size_t _Size) {
+        void* block = std::malloc(_Size + kAllocHeader);
+        if (!block)
+            throw std::bad_alloc();
+
+        *static_cast<size_t*>(block) = _Size;
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_live_bytes.fetch_add(_Size, std::memory_order_relaxed);
+        return static_cast<char*>(block) + kAllocHeader;
+    }
+
+    void counted_free(void* _Ptr) {
+        if (!_Ptr)
+            return;
+
+        void* block = static_cast<char*>(_Ptr) - kAllocHeader;
+        g_live_bytes.fetch_sub(*static_cast<size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+
+void* operator new(size_t _Size) { return counted_alloc(_Size); }
+void* operator new[](size_t _Size) { return counted_alloc(_Size); }
+void operator delete(void* _Ptr) noexcept { counted_free(_Ptr); }
+void operator delete[](void* _Ptr) noexcept { counted_free(_Ptr); }
+void operator delete(void* _Ptr, size_t) noexcept { counted_free(_Ptr); }
+void operator delete[](void* _Ptr, size_t) noexcept { counted_free(_Ptr); }
+
+namespace {
+    // world and seed shared by every benchmark so runs are reproducible
+    constexpr double kWorldSize = 65536.0;
+    constexpr uint64_t kSeed = 0x5eed;
+
+    enum Distribution {
+        kUniform,
+        kClustered,
+        kSkewed,
+        kMixedSizes
+    };
+
+    const char* distribution_name(Distribution _Dist) {
+        switch (_Dist) {
+        case kUniform: return "uniform";
+        case kClustered: return "clustered";
+        case kSkewed: return "skewed";
+        case kMixedSizes: return "mixed_sizes";
+        }
+        return "";
+    }
+
+    template <typename T>
+    nc::QuadTreeAABB<T> make_box(double _X, double _Y, double _W, double _H) {
+        _X = std::min(std::max(_X, 0.0), kWorldSize - _W - 1.0);
+        _Y = std::min(std::max(_Y, 0.0), kWorldSize - _H - 1.0);
+        return nc::QuadTreeAABB<T>((T)_X, (T)_Y, (T)(_X + _W), (T)(_Y + _H));
+    }
+
+    template <typename T>
+    std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> make_objects(size_t _Count, Distribution _Dist) {
+        std::mt19937_64 rng(kSeed);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::normal_distribution<double> spread(0.0, kWorldSize / 64.0);
+
+        double centers[16][2];
+        for (size_t i = 0; i < 16; i++) {
+            centers[i][0] = unit(rng) * kWorldSize;
+            centers[i][1] = unit(rng) * kWorldSize;
+        }
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> objects;
+        objects.reserve(_Count);
+
+        for (size_t i = 0; i < _Count; i++) {
+            double x, y, w = 4.0, h = 4.0;
+
+            switch (_Dist) {
+            case kUniform:
+                x = unit(rng) * kWorldSize;
+                y = unit(rng) * kWorldSize;
+                break;
+            case kClustered: {
+                const double* center = centers[rng() % 16];
+                x = center[0] + spread(rng);
+                y = center[1] + spread(rng);
+                break;
+            }
+            case kSkewed:
+                // density falls off towards the far corner
+                x = unit(rng) * unit(rng) * unit(rng) * kWorldSize;
+                y = unit(rng) * unit(rng) * unit(rng) * kWorldSize;
+                break;
+            case kMixedSizes:
+            default:
+                x = unit(rng) * kWorldSize;
+                y = unit(rng) * kWorldSize;
+                if (unit(rng) < 0.05) {
+                    w = 256.0 + unit(rng) * 2048.0;
+                    h = 256.0 + unit(rng) * 2048.0;
+                }
+                break;
+            }
+
+            objects.push_back(std::make_shared<nc::QuadTreeObject<T>>(
+                make_box<T>(x, y, w, h), nullptr, i));
+        }
+
+        return objects;
+    }
+
+    template <typename T>
+    std::vector<nc::QuadTreeAABB<T>> make_queries(size_t _Count, double _Size) {
+        std::mt19937_64 rng(kSeed + 1);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+        std::vector<nc::QuadTreeAABB<T>> queries;
+        for (size_t i = 0; i < _Count; i++)
+            queries.push_back(make_box<T>(unit(rng) * kWorldSize, unit(rng) * kWorldSize, _Size, _Size));
+
+        return queries;
+    }
+
+    template <typename T>
+    nc::QuadTreeAABB<T> world() {
+        return nc::QuadTreeAABB<T>((T)0, (T)0, (T)kWorldSize, (T)kWorldSize);
+    }
+
+    // allocations and bytes per processed item since the benchmark started
+    struct AllocationScope {
+        size_t allocations = g_allocations.load();
+
+        void report(benchmark::State& _State, size_t _Items) const {
+            double items = (double)std::max<size_t>(_Items, 1);
+            _State.counters["allocs/op"] = (double)(g_allocations.load() - allocations) / items;
+        }
+    };
+
+    template <typename T, size_t _Capacity>
+    void bm_insert(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        AllocationScope scope;
+        size_t bytes = 0;
+
+        for (auto _ : _State) {
+            size_t live = g_live_bytes.load();
+            nc::QuadTree<T, _Capacity> tree(world<T>());
+
+            for (const auto& object : objects)
+                tree.insert(object);
+
+            bytes = g_live_bytes.load() - live;
+            benchmark::DoNotOptimize(tree.get_total_objects());
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * count);
+        _State.counters["bytes/object"] = (double)bytes / (double)count;
+        scope.report(_State, _State.iterations() * count);
+    }
+
+    // per-frame tree in a monotonic arena that is released in one step
+    // instead of freeing the pools, compare with insert
+    template <typename T, size_t _Capacity>
+    void bm_arena_insert(benchmark::State& _State, Distribution _Dist) {
+        typedef std::pmr::polymorphic_allocator<std::byte> arena_allocator;
+
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        std::pmr::monotonic_buffer_resource arena;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            {
+                nc::QuadTree<T, _Capacity, void*, nc::QuadTreePolicy<_Capacity>, arena_allocator>
+                    tree(world<T>(), arena_allocator(&arena));
+
+                for (const auto& object : objects)
+                    tree.insert(object);
+
+                benchmark::DoNotOptimize(tree.get_total_objects());
+            }
+            arena.release();
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * count);
+        scope.report(_State, _State.iterations() * count);
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_remove(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            _State.PauseTiming();
+            nc::QuadTree<T, _Capacity> tree(world<T>());
+            for (const auto& object : objects)
+                tree.insert(object);
+            _State.ResumeTiming();
+
+            for (const auto& object : objects)
+                tree.remove(object);
+
+            benchmark::DoNotOptimize(tree.get_total_objects());
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * count);
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_query_vector(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> results;
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            results.clear();
+            tree.query(queries[query++ & 1023], results);
+            hits += results.size();
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_query_array(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> results(count);
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            size_t length = 0;
+            tree.query(queries[query++ & 1023], results.data(), results.size(), length);
+            hits += length;
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    // same queries against 16 shards, the overlapping shards are read locked together
+    template <typename T, size_t _Capacity>
+    void bm_sharded_query(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::ShardedQuadTree<T, _Capacity> tree(world<T>(), 2);
+        tree.insert_batch(objects.begin(), objects.end());
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> results;
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            results.clear();
+            tree.query(queries[query++ & 1023], results);
+            hits += results.size();
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    // repeatedly fills one node past its capacity and empties it again, so
+    // every round splits and merges
+    template <typename T>
+    void bm_linear_query(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::LinearQuadTree<T> tree(world<T>(), objects.begin(), objects.end());
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> results;
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            results.clear();
+            tree.query(queries[query++ & 1023], results);
+            hits += results.size();
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_nearest(benchmark::State& _State, Distribution _Dist) {
+        constexpr size_t kNeighbours = 8;
+
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        std::shared_ptr<nc::QuadTreeObject<T>> results[kNeighbours];
+        double distances[kNeighbours];
+        size_t query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            const nc::QuadTreeAABB<T>& point = queries[query++ & 1023];
+            benchmark::DoNotOptimize(tree.nearest(point.x, point.y, kNeighbours, results, distances));
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_query_circle(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 32.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        // discs inscribed in the query boxes
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            const nc::QuadTreeAABB<T>& bounds = queries[query++ & 1023];
+            tree.query_circle(bounds.x, bounds.y, (double)bounds.width / 2.0, [&](void*) { hits++; });
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_query_convex(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 32.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        // view frustum like trapezoids opening to the right of each query box
+        std::vector<std::vector<std::pair<T, T>>> polygons;
+        for (const auto& bounds : queries) {
+            const T quarter = bounds.height / (T)4;
+            polygons.push_back({ { bounds.left, (T)(bounds.y - quarter) }, { bounds.right, bounds.top },
+                { bounds.right, bounds.bottom }, { bounds.left, (T)(bounds.y + quarter) } });
+        }
+
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            tree.query_convex(polygons[query++ & 1023], [&](void*) { hits++; });
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_raycast(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        // a ray leaving the world misses everything, also without a limit
+        std::vector<std::pair<double, typename nc::QuadTree<T, _Capacity>::object_ptr>> missed;
+        if (tree.raycast((T)-1, (T)-1, -1.0, 0.0) != nullptr
+            || tree.raycast((T)-1, (T)-1, -1.0, 0.0, std::numeric_limits<double>::infinity(), missed) != 0) {
+            _State.SkipWithError("raycast reported a hit for a ray that misses");
+            return;
+        }
+
+        // diagonal rays between pairs of query centers
+        size_t hits = 0, query = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            const nc::QuadTreeAABB<T>& from = queries[query & 1023];
+            const nc::QuadTreeAABB<T>& to = queries[(query + 512) & 1023];
+            query++;
+
+            hits += tree.raycast(from.x, from.y, (double)to.x - from.x, (double)to.y - from.y, 1.0) != nullptr;
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["hits/query"] = (double)hits / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_all_pairs(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        size_t pairs = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            tree.all_pairs([&](void*, void*) { pairs++; });
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * count);
+        _State.counters["pairs"] = (double)pairs / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_split_merge(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        std::vector<std::shared_ptr<nc::QuadTreeObject<T>>> churn;
+        for (size_t i = 0; i <= _Capacity; i++) {
+            churn.push_back(std::make_shared<nc::QuadTreeObject<T>>(
+                make_box<T>(kWorldSize / 3.0 + (double)i, kWorldSize / 3.0, 1.0, 1.0), nullptr, count + i));
+        }
+
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            for (const auto& object : churn)
+                tree.insert(object);
+            for (const auto& object : churn)
+                tree.remove(object);
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * churn.size() * 2);
+        scope.report(_State, _State.iterations());
+    }
+
+    // objects drifting under 1024 standing queries, the cost per update
+    // compact() on a tree left with every tenth object after a churn of
+    // removals, the counters show how many pool nodes it dropped
+    template <typename T, size_t _Capacity>
+    void bm_compact(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto queries = make_queries<T>(1024, kWorldSize / 128.0);
+
+        size_t before = 0, after = 0;
+
+        for (auto _ : _State) {
+            _State.PauseTiming();
+            nc::QuadTree<T, _Capacity> tree(world<T>());
+            for (const auto& object : objects)
+                tree.insert(object);
+            for (size_t i = 0; i < count; i++) {
+                if (i % 10 != 0)
+                    tree.remove(objects[i]);
+            }
+            before = tree.get_node_count();
+            _State.ResumeTiming();
+
+            tree.compact();
+
+            after = tree.get_node_count();
+            benchmark::DoNotOptimize(tree.query(queries[0], [](const auto&) {}));
+        }
+
+        _State.SetItemsProcessed(_State.iterations() * count / 10);
+        _State.counters["nodes_before"] = (double)before;
+        _State.counters["nodes_after"] = (double)after;
+    }
+
+    // should follow the events rather than the number of subscriptions
+    template <typename T, size_t _Capacity>
+    void bm_update_subscribed(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+        auto views = make_queries<T>(1024, kWorldSize / 128.0);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        size_t events = 0;
+        for (const auto& view : views) {
+            tree.subscribe(view, [&](const std::shared_ptr<nc::QuadTreeObject<T>>&, nc::QuadTreeEvent) {
+                events++;
+            });
+        }
+        events = 0;
+
+        std::mt19937_64 rng(kSeed + 2);
+        std::uniform_real_distribution<double> step(-8.0, 8.0);
+        size_t next = 0;
+        AllocationScope scope;
+
+        for (auto _ : _State) {
+            const auto& object = objects[next++ % count];
+            const double w = (double)object->bounds.right - (double)object->bounds.left;
+            const double h = (double)object->bounds.bottom - (double)object->bounds.top;
+
+            tree.update(object->id, make_box<T>((double)object->bounds.left + step(rng),
+                (double)object->bounds.top + step(rng), w, h));
+        }
+
+        _State.SetItemsProcessed(_State.iterations());
+        _State.counters["events/update"] = (double)events / (double)_State.iterations();
+        scope.report(_State, _State.iterations());
+    }
+
+    template <typename T, size_t _Capacity>
+    void bm_total_objects(benchmark::State& _State, Distribution _Dist) {
+        const size_t count = (size_t)_State.range(0);
+        auto objects = make_objects<T>(count, _Dist);
+
+        nc::QuadTree<T, _Capacity> tree(world<T>());
+        for (const auto& object : objects)
+            tree.insert(object);
+
+        for (auto _ : _State)
+            benchmark::DoNotOptimize(tree.get_total_objects());
+
+        _State.SetItemsProcessed(_State.iterations());
+    }
+
+    const char* type_name(float*) { return "float"; }
+    const char* type_name(double*) { return "double"; }
+    const char* type_name(int*) { return "int"; }
+
+    template <typename T, size_t _Capacity>
+    void register_benchmarks() {
+        typedef void (*Function)(benchmark::State&, Distribution);
+
+        static const struct {
+            const char* name;
+            Function function;
+        } kOperations[] = {
+            { "insert", &bm_insert<T, _Capacity> },
+            { "arena_insert", &bm_arena_insert<T, _Capacity> },
+            { "remove", &bm_remove<T, _Capacity> },
+            { "query_vector", &bm_query_vector<T, _Capacity> },
+            { "query_array", &bm_query_array<T, _Capacity> },
+            { "query_circle", &bm_query_circle<T, _Capacity> },
+            { "query_convex", &bm_query_convex<T, _Capacity> },
+            { "sharded_query", &bm_sharded_query<T, _Capacity> },
+            { "nearest", &bm_nearest<T, _Capacity> },
+            { "raycast", &bm_raycast<T, _Capacity> },
+            { "all_pairs", &bm_all_pairs<T, _Capacity> },
+            { "split_merge", &bm_split_merge<T, _Capacity> },
+            { "update_subscribed", &bm_update_subscribed<T, _Capacity> },
+            { "compact", &bm_compact<T, _Capacity> },
+            { "get_total_objects", &bm_total_objects<T, _Capacity> },
+        };
+
+        for (const auto& operation : kOperations) {
+            for (Distribution dist : { kUniform, kClustered, kSkewed, kMixedSizes }) {
+                std::string name = std::string(operation.name) + "/" + type_name((T*)nullptr)
+                    + "/cap" + std::to_string(_Capacity) + "/" + distribution_name(dist);
+
+                benchmark::RegisterBenchmark(name.c_str(), operation.function, dist)
+                    ->RangeMultiplier(10)->Range(1000, 100000);
+            }
+        }
+    }
+
+    template <typename T>
+    void register_capacities() {
+        register_benchmarks<T, 2>();
+        register_benchmarks<T, 4>();
+        register_benchmarks<T, 8>();
+        register_benchmarks<T, 16>();
+        register_benchmarks<T, 32>();
+        register_benchmarks<T, 64>();
+
+        // the linear tree has no capacity
+        for (Distribution dist : { kUniform, kClustered, kSkewed, kMixedSizes }) {
+            std::string name = std::string("linear_query/") + type_name((T*)nullptr)
+                + "/" + distribution_name(dist);
+
+            benchmark::RegisterBenchmark(name.c_str(), &bm_linear_query<T>, dist)
+                ->RangeMultiplier(10)->Range(1000, 100000);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    register_capacities<float>();
+    register_capacities<double>();
+    register_capacities<int>();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
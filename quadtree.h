@@ -12,8 +12,84 @@
 
 #include <vector>
 #include <memory>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <functional>
+
+#include "quadtree_simd.h"
+
+// define NC_QUADTREE_ENABLE_COUNTERS to collect QuadTreeCounters
+#if defined(NC_QUADTREE_ENABLE_COUNTERS)
+#define NC_QUADTREE_COUNT(_Field, _Amount) (::nc::quadtree_counters()._Field += (_Amount))
+#else
+#define NC_QUADTREE_COUNT(_Field, _Amount) ((void)0)
+#endif
 
 namespace nc {
+    namespace detail {
+        // runs _Fn(task) for every task in [0, _Tasks) on _Threads threads,
+        // including the calling one. idle threads take the next task from a
+        // shared counter so uneven subtrees balance out
+        template <typename _Func>
+        inline void parallel_for(size_t _Tasks, size_t _Threads, _Func&& _Fn) {
+            std::atomic<size_t> next(0);
+
+            auto worker = [&]() {
+                for (size_t task = next++; task < _Tasks; task = next++)
+                    _Fn(task);
+            };
+
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < std::min(_Threads, _Tasks); i++)
+                workers.emplace_back(worker);
+
+            worker();
+
+            for (std::thread& thread : workers)
+                thread.join();
+        }
+
+        inline size_t default_threads() {
+            return std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        // visitors may return void or bool, false stops the query
+        template <typename _Visitor, typename... _Args>
+        inline bool visit(_Visitor& _Visit, const _Args&... _Arguments) {
+            if constexpr (std::is_void_v<std::invoke_result_t<_Visitor&, const _Args&...>>) {
+                _Visit(_Arguments...);
+                return true;
+            }
+            else {
+                return static_cast<bool>(_Visit(_Arguments...));
+            }
+        }
+
+        // center of [_A, _B], integers take the half distance with a shift
+        // so the sum cannot overflow for boxes spanning the whole range
+        template <typename T>
+        inline T midpoint(T _A, T _B) {
+            if constexpr (std::is_integral_v<T>) {
+                typedef std::make_unsigned_t<T> unsigned_type;
+                const unsigned_type distance = static_cast<unsigned_type>(
+                    static_cast<unsigned_type>(_B) - static_cast<unsigned_type>(_A));
+                return static_cast<T>(_A + static_cast<T>(distance >> 1));
+            }
+            else {
+                return (_A + _B) / (T)2;
+            }
+        }
+    } // namespace detail
+
     template <typename T>
     class QuadTreeAABB {
     public:
@@ -24,7 +100,16 @@ namespace nc {
         // dimensions
         T width, height;
 
-        QuadTreeAABB() {}
+        QuadTreeAABB() :
+            left(),
+            top(),
+            right(),
+            bottom(),
+            x(),
+            y(),
+            width(),
+            height() {
+        }
         QuadTreeAABB(const QuadTreeAABB& _Other) :
             left(_Other.left),
             top(_Other.top),
@@ -72,14 +157,16 @@ namespace nc {
 
         ~QuadTreeAABB() {}
 
+        QuadTreeAABB& operator=(const QuadTreeAABB& _Other) = default;
+
         void set_dimensions() {
-            width = bottom - top;
-            height = right - left;
+            width = right - left;
+            height = bottom - top;
         }
 
         void set_center() {
-            x = (left + right) / (T)2;
-            y = (top + bottom) / (T)2;
+            x = detail::midpoint(left, right);
+            y = detail::midpoint(top, bottom);
         }
 
         bool verify() const {
@@ -99,346 +186,3289 @@ namespace nc {
         }
     };
 
+    // compact box holding only the boundaries, center and dimensions are
+    // derived on demand. used for node max_bounds and leaf object storage
     template <typename T>
+    class QuadTreeBox {
+    public:
+        T left, top, right, bottom;
+
+        QuadTreeBox() :
+            left(),
+            top(),
+            right(),
+            bottom() {
+        }
+        QuadTreeBox(T _Left, T _Top, T _Right, T _Bottom) :
+            left(_Left),
+            top(_Top),
+            right(_Right),
+            bottom(_Bottom) {
+        }
+
+        QuadTreeBox(const QuadTreeAABB<T>& _Other) :
+            left(_Other.left),
+            top(_Other.top),
+            right(_Other.right),
+            bottom(_Other.bottom) {
+        }
+
+        // box that never intersects anything, used for empty slots
+        static QuadTreeBox empty() {
+            return QuadTreeBox(std::numeric_limits<T>::max(), std::numeric_limits<T>::max(),
+                std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest());
+        }
+
+        T center_x() const { return detail::midpoint(left, right); }
+        T center_y() const { return detail::midpoint(top, bottom); }
+        T width() const { return right - left; }
+        T height() const { return bottom - top; }
+
+        QuadTreeAABB<T> to_aabb() const {
+            return QuadTreeAABB<T>(left, top, right, bottom);
+        }
+
+        bool verify() const {
+            return ((left < right) && (top < bottom));
+        }
+
+        // squared distance from the point to the closest point of the box,
+        // 0 inside. evaluated in double so integer coordinates cannot overflow
+        double distance_squared(T _X, T _Y) const {
+            const double dx = std::max({ (double)left - _X, 0.0, (double)_X - right });
+            const double dy = std::max({ (double)top - _Y, 0.0, (double)_Y - bottom });
+            return dx * dx + dy * dy;
+        }
+
+        // accepts both QuadTreeBox and QuadTreeAABB
+        template <typename _Box>
+        bool intersects(const _Box& _Other) const {
+            return (left < _Other.right &&
+                right > _Other.left &&
+                top < _Other.bottom &&
+                bottom > _Other.top);
+        }
+
+        bool contains(T _X, T _Y) const {
+            return ((_X > left) && (_X < right)
+                && (_Y > top) && (_Y < bottom));
+        }
+
+        template <typename _Box>
+        bool contains(const _Box& _Other) const {
+            return (left <= _Other.left && top <= _Other.top &&
+                right >= _Other.right && bottom >= _Other.bottom);
+        }
+
+        template <typename _Box>
+        void expand(const _Box& _Other) {
+            left = std::min(left, _Other.left);
+            top = std::min(top, _Other.top);
+            right = std::max(right, _Other.right);
+            bottom = std::max(bottom, _Other.bottom);
+        }
+    };
+
+    namespace detail {
+        // how a region query relates to a box
+        enum class Overlap { outside, partial, inside };
+
+        // open disc, boxes that only touch its edge are outside like with
+        // QuadTreeAABB::intersects()
+        struct CircleRegion {
+            double x, y, radius_squared;
+
+            CircleRegion(double _X, double _Y, double _Radius) :
+                x(_X), y(_Y), radius_squared(_Radius * _Radius) {
+            }
+
+            template <typename _Box>
+            Overlap classify(const _Box& _Bounds) const {
+                const double near_x = std::max({ (double)_Bounds.left - x, 0.0, x - (double)_Bounds.right });
+                const double near_y = std::max({ (double)_Bounds.top - y, 0.0, y - (double)_Bounds.bottom });
+                if (!within(near_x, near_y))
+                    return Overlap::outside;
+
+                // the farthest corner decides whether the box is covered
+                const double far_x = std::max(std::abs(x - (double)_Bounds.left), std::abs((double)_Bounds.right - x));
+                const double far_y = std::max(std::abs(y - (double)_Bounds.top), std::abs((double)_Bounds.bottom - y));
+                return within(far_x, far_y) ? Overlap::inside : Overlap::partial;
+            }
+
+            template <typename _Box>
+            bool intersects(const _Box& _Bounds) const {
+                const double near_x = std::max({ (double)_Bounds.left - x, 0.0, x - (double)_Bounds.right });
+                const double near_y = std::max({ (double)_Bounds.top - y, 0.0, y - (double)_Bounds.bottom });
+                return within(near_x, near_y);
+            }
+
+            bool within(double _Dx, double _Dy) const {
+                return _Dx * _Dx + _Dy * _Dy < radius_squared;
+            }
+        };
+
+        // open convex polygon as the intersection of the half planes
+        // a * x + b * y + c > 0 of its edges, plus its bounding box for the
+        // box axes of the separating axis test
+        struct ConvexRegion {
+            struct Plane {
+                double a, b, c;
+            };
+
+            std::vector<Plane> planes;
+            QuadTreeBox<double> bounds;
+
+            template <typename T>
+            ConvexRegion(const std::vector<std::pair<T, T>>& _Polygon) :
+                bounds(QuadTreeBox<double>::empty()) {
+                const size_t count = _Polygon.size();
+                if (count < 3)
+                    throw std::invalid_argument("polygon needs at least three vertices");
+
+                double area = 0.0;
+                for (size_t i = 0; i < count; i++) {
+                    const std::pair<T, T>& a = _Polygon[i];
+                    const std::pair<T, T>& b = _Polygon[(i + 1) % count];
+                    area += (double)a.first * (double)b.second - (double)b.first * (double)a.second;
+
+                    bounds.expand(QuadTreeBox<double>(a.first, a.second, a.first, a.second));
+                }
+
+                // either winding is accepted, a flat polygon contains nothing
+                const double winding = area > 0.0 ? 1.0 : area < 0.0 ? -1.0 : 0.0;
+
+                planes.reserve(count);
+                for (size_t i = 0; i < count; i++) {
+                    const double ax = (double)_Polygon[i].first, ay = (double)_Polygon[i].second;
+                    const double bx = (double)_Polygon[(i + 1) % count].first;
+                    const double by = (double)_Polygon[(i + 1) % count].second;
+
+                    // the interior is left of a->b for a positive area
+                    const double a = -(by - ay) * winding;
+                    const double b = (bx - ax) * winding;
+                    planes.push_back(Plane{ a, b, -(a * ax + b * ay) });
+                }
+            }
+
+            template <typename _Box>
+            Overlap classify(const _Box& _Bounds) const {
+                if (!bounds.intersects(_Bounds))
+                    return Overlap::outside;
+
+                bool inside = true;
+
+                for (const Plane& plane : planes) {
+                    // corners of the box farthest into and out of the half plane
+                    const double high = plane.a * (plane.a > 0.0 ? (double)_Bounds.right : (double)_Bounds.left)
+                        + plane.b * (plane.b > 0.0 ? (double)_Bounds.bottom : (double)_Bounds.top) + plane.c;
+                    if (!(high > 0.0))
+                        return Overlap::outside;
+
+                    const double low = plane.a * (plane.a > 0.0 ? (double)_Bounds.left : (double)_Bounds.right)
+                        + plane.b * (plane.b > 0.0 ? (double)_Bounds.top : (double)_Bounds.bottom) + plane.c;
+                    if (!(low > 0.0))
+                        inside = false;
+                }
+
+                return inside ? Overlap::inside : Overlap::partial;
+            }
+
+            template <typename _Box>
+            bool intersects(const _Box& _Bounds) const {
+                return classify(_Bounds) != Overlap::outside;
+            }
+        };
+    } // namespace detail
+
+    // maps floating point boxes onto a fixed grid of integer coordinates
+    // spanning _World, so a QuadTree<int32_t> or QuadTree<uint16_t> can index
+    // float data. boxes are rounded outwards and never lose an intersection,
+    // the grid cell size bounds the number of false positives.
+    // smaller T packs more boxes per cache line and per SIMD register
+    template <typename T, typename F = double>
+    class QuadTreeQuantizer {
+        static_assert(std::is_integral_v<T>, "grid coordinates must be integers");
+    public:
+        static constexpr T kGridMax = std::numeric_limits<T>::max();
+
+        QuadTreeQuantizer() {}
+        QuadTreeQuantizer(const QuadTreeAABB<F>& _World) {
+            set_world(_World);
+        }
+
+        void set_world(const QuadTreeAABB<F>& _World) {
+            world = _World;
+            scale_x = (double)kGridMax / ((double)_World.right - (double)_World.left);
+            scale_y = (double)kGridMax / ((double)_World.bottom - (double)_World.top);
+        }
+
+        const QuadTreeAABB<F>& get_world() const { return world; }
+
+        // root bounds for the integer tree
+        static QuadTreeAABB<T> grid_bounds() {
+            return QuadTreeAABB<T>(0, 0, kGridMax, kGridMax);
+        }
+
+        T quantize_x(F _X, bool _Up = false) const {
+            return to_grid(((double)_X - (double)world.left) * scale_x, _Up);
+        }
+
+        T quantize_y(F _Y, bool _Up = false) const {
+            return to_grid(((double)_Y - (double)world.top) * scale_y, _Up);
+        }
+
+        // smallest grid box covering _Box, at least one cell wide
+        QuadTreeAABB<T> quantize(const QuadTreeAABB<F>& _Box) const {
+            T left = quantize_x(_Box.left), top = quantize_y(_Box.top);
+            T right = quantize_x(_Box.right, true), bottom = quantize_y(_Box.bottom, true);
+
+            if (right <= left) {
+                if (left == kGridMax) left--;
+                right = left + 1;
+            }
+            if (bottom <= top) {
+                if (top == kGridMax) top--;
+                bottom = top + 1;
+            }
+
+            return QuadTreeAABB<T>(left, top, right, bottom);
+        }
+
+        F dequantize_x(T _X) const { return (F)((double)world.left + (double)_X / scale_x); }
+        F dequantize_y(T _Y) const { return (F)((double)world.top + (double)_Y / scale_y); }
+
+        QuadTreeAABB<F> dequantize(const QuadTreeAABB<T>& _Box) const {
+            return QuadTreeAABB<F>(dequantize_x(_Box.left), dequantize_y(_Box.top),
+                dequantize_x(_Box.right), dequantize_y(_Box.bottom));
+        }
+    private:
+        QuadTreeAABB<F> world;
+        double scale_x = 1.0, scale_y = 1.0;
+
+        static T to_grid(double _Value, bool _Up) {
+            _Value = _Up ? std::ceil(_Value) : std::floor(_Value);
+            return static_cast<T>(std::min(std::max(_Value, 0.0), (double)kGridMax));
+        }
+    };
+
+    // P is copied into the leaf on insert, so small payloads such as
+    // handles or indices can be read by query visitors without touching
+    // the object itself
+    template <typename T, typename P = void*>
     class QuadTreeObject {
     public:
         QuadTreeObject() {}
-        QuadTreeObject(const QuadTreeAABB<T>& _Boundaries, void* _UserData, size_t _Id)
+        QuadTreeObject(const QuadTreeAABB<T>& _Boundaries, const P& _UserData, size_t _Id)
             : bounds(_Boundaries), user_data(_UserData), id(_Id) {}
         ~QuadTreeObject() {}
 
         QuadTreeAABB<T> bounds;
-        void* user_data;
+        P user_data;
 
         // unique id used to remove the object later
         size_t id;
     };
 
-    template <typename T = double, size_t _Capacity = 2>
-    class QuadTree 
-        : public std::enable_shared_from_this<QuadTree<T,_Capacity>> {
+    // snapshot of a tree's shape and memory, see QuadTree::stats()
+    struct QuadTreeStats {
+        size_t nodes = 0;
+        size_t leaves = 0;
+        // pool nodes in released blocks waiting for reuse
+        size_t free_nodes = 0;
+        size_t max_depth = 0;
+        // reachable nodes per level, index 0 is the root
+        std::vector<size_t> depth_histogram;
+
+        size_t objects = 0;
+        size_t slots = 0;
+        // leaf blocks chained behind the first one of nodes that cannot split
+        size_t overflow_leaves = 0;
+        // objects / slots over all reachable nodes
+        double fill_ratio = 0.0;
+
+        size_t node_bytes = 0;
+        // objects and their shared_ptr control blocks, assuming make_shared
+        // and no other owners
+        size_t object_bytes = 0;
+        // estimate for the id to location map
+        size_t index_bytes = 0;
+        size_t total_bytes = 0;
+    };
+
+    // work done by tree operations on the calling thread, only updated when
+    // NC_QUADTREE_ENABLE_COUNTERS is defined. shared by all trees, work of
+    // parallel helpers is counted on their own threads
+    struct QuadTreeCounters {
+        uint64_t nodes_visited = 0;
+        // node and object box tests, batch scans count every slot
+        uint64_t intersection_tests = 0;
+        uint64_t splits = 0;
+        uint64_t merges = 0;
+
+        void reset() { *this = QuadTreeCounters(); }
+    };
+
+    inline QuadTreeCounters& quadtree_counters() {
+        static thread_local QuadTreeCounters counters;
+        return counters;
+    }
+
+    // change reported to a standing query, see QuadTree::subscribe()
+    enum class QuadTreeEvent {
+        // the object started to intersect the region
+        enter,
+        // the object stopped to intersect the region or was removed
+        leave
+    };
+
+    // compile time node rules of QuadTree. derive from QuadTreePolicy and
+    // hide the members that should differ, for example
+    //   struct Shallow : QuadTreePolicy<8> { static constexpr size_t kMaxDepth = 10; };
+    //   QuadTree<double, 8, void*, Shallow> tree;
+    template <size_t _Capacity = 2>
+    struct QuadTreePolicy {
+        // object slots per node, has to match the capacity of the tree
+        static constexpr size_t kCapacity = _Capacity;
+        // nodes deeper than this are not subdivided, a full node there
+        // chains further leaf blocks instead and never gets children
+        static constexpr size_t kMaxDepth = 32;
+        // nodes whose children would be narrower or lower than this are
+        // handled like nodes at kMaxDepth
+        static constexpr double kMinSize = 0.0;
+        // an insert into a node holding this many objects moves on to the
+        // children, at most kCapacity
+        static constexpr size_t kSplitThreshold = _Capacity;
+        // a subtree is merged back into its root once it holds at most this
+        // many objects. staying below the split threshold leaves room in the
+        // merged node so a following insert does not split it right away
+        static constexpr size_t kMergeThreshold = _Capacity / 2;
+    };
+
+    // _Allocator is rebound for the node and leaf pools, the id map and
+    // the subscription lists, std::pmr::polymorphic_allocator<std::byte>
+    // lets a tree live in a memory resource such as an arena
+    template <typename T = double, size_t _Capacity = 2, typename P = void*,
+        typename _Policy = QuadTreePolicy<_Capacity>, typename _Allocator = std::allocator<std::byte>>
+    class QuadTree {
+    public:
+        typedef QuadTreeObject<T, P> object_type;
+        typedef std::shared_ptr<object_type> object_ptr;
+        typedef _Allocator allocator_type;
+
+        // nodes are addressed by 32-bit indices into the tree's node pool
+        typedef uint32_t node_index;
+
+        typedef std::function<void(const object_ptr&, QuadTreeEvent)> subscription_callback;
+
+        static constexpr node_index kInvalidNode = std::numeric_limits<node_index>::max();
+        static constexpr node_index kRootNode = 0;
     private:
         static constexpr size_t kChildren = 4;
 
-        QuadTreeAABB<T> bounds;
-        QuadTreeAABB<T> max_bounds;
+        template <typename _Type>
+        using rebind_alloc = typename std::allocator_traits<_Allocator>::template rebind_alloc<_Type>;
+        template <typename _Type>
+        using pool = std::vector<_Type, rebind_alloc<_Type>>;
+
+        static constexpr size_t kMaxDepth = _Policy::kMaxDepth;
+        static constexpr double kMinSize = _Policy::kMinSize;
+        static constexpr size_t kSplitThreshold = _Policy::kSplitThreshold;
+        static constexpr size_t kMergeThreshold = _Policy::kMergeThreshold;
+
+        static_assert(_Policy::kCapacity == _Capacity, "policy capacity does not match the tree");
+        static_assert(kSplitThreshold >= 1 && kSplitThreshold <= _Capacity,
+            "split threshold must be within the node capacity");
+        static_assert(kMergeThreshold <= _Capacity, "merged subtrees must fit into one node");
+
+        // leaf scans go through the batch kernel once a node holds at least
+        // one full vector of boxes
+        static constexpr bool kBatchScan = detail::simd_lanes<T>() > 1
+            && _Capacity >= detail::simd_lanes<T>();
+
+        // nodes only carry the tree structure, so the upper levels every
+        // query walks through stay small and dense in the cache. object
+        // storage lives in a separate pool of leaves, rarely used per node
+        // state in side arrays next to the node pool
+        struct Node {
+            // centers are derived, split() halves at the same midpoint
+            QuadTreeBox<T> bounds;
+            QuadTreeBox<T> max_bounds;
+
+            // first of the four sibling children, kInvalidNode for leaves
+            node_index children = kInvalidNode;
+            node_index root = kInvalidNode;
+            // first block of object storage in the leaf pool, kInvalidNode
+            // while the node holds no objects. only leaves hold objects unless
+            // the tree is loose, nodes that cannot split chain more blocks
+            node_index leaf = kInvalidNode;
+
+            uint32_t level = 1;
+            uint32_t object_count = 0;
+            // objects in this node and all of its descendants, trees are
+            // limited to kMaxObjects
+            uint32_t total_count = 0;
+
+            bool has_children() const { return children != kInvalidNode; }
+        };
+
+        struct Leaf {
+            // object bounds as structure of arrays, empty slots hold
+            // QuadTreeBox::empty() so they never pass an intersection test
+            T object_left[_Capacity];
+            T object_top[_Capacity];
+            T object_right[_Capacity];
+            T object_bottom[_Capacity];
+            object_ptr objects[_Capacity];
+            // copies of objects[i]->user_data next to the bounds
+            P payloads[_Capacity];
+
+            // node the block stores objects for
+            node_index owner = kInvalidNode;
+            // next block of a node that cannot split, every block after the
+            // first is full
+            node_index next = kInvalidNode;
+
+            Leaf() {
+                for (size_t i = 0; i < _Capacity; i++)
+                    clear_object(i);
+            }
+
+            template <typename _Box>
+            bool object_intersects(size_t _Slot, const _Box& _Bounds) const {
+                return (object_left[_Slot] < _Bounds.right &&
+                    object_right[_Slot] > _Bounds.left &&
+                    object_top[_Slot] < _Bounds.bottom &&
+                    object_bottom[_Slot] > _Bounds.top);
+            }
+
+            // calls _Func(slot) for each object intersecting _Bounds until it
+            // returns false, returns false if the scan was stopped
+            template <typename _Box, typename _Func>
+            bool scan_objects(const _Box& _Bounds, _Func&& _Fn) const {
+                NC_QUADTREE_COUNT(intersection_tests, _Capacity);
+
+                if constexpr (kBatchScan) {
+                    for (size_t base = 0; base < _Capacity; base += detail::kMaskBits) {
+                        uint64_t mask = detail::intersect_mask(object_left + base,
+                            object_top + base, object_right + base, object_bottom + base,
+                            std::min(detail::kMaskBits, _Capacity - base),
+                            _Bounds.left, _Bounds.top, _Bounds.right, _Bounds.bottom);
+
+                        while (mask) {
+                            size_t i = base + detail::count_trailing_zeros(mask);
+                            mask &= mask - 1;
+
+                            if (!_Fn(i))
+                                return false;
+                        }
+                    }
+                }
+                else {
+                    for (size_t i = 0; i < _Capacity; i++) {
+                        if (object_intersects(i, _Bounds) && !_Fn(i))
+                            return false;
+                    }
+                }
 
-        size_t object_count = 0;
-        std::vector<std::shared_ptr<QuadTreeObject<T>>> objects;
-        std::vector<std::shared_ptr<QuadTree<T,_Capacity>>> children;
-        std::shared_ptr<QuadTree<T, _Capacity>> root;
+                return true;
+            }
 
-        bool has_children = false;
+            QuadTreeBox<T> object_bounds(size_t _Slot) const {
+                return QuadTreeBox<T>(object_left[_Slot], object_top[_Slot],
+                    object_right[_Slot], object_bottom[_Slot]);
+            }
 
-        void split();
-        void merge();
+            void set_object(size_t _Slot, const object_ptr& _Object) {
+                objects[_Slot] = _Object;
+                payloads[_Slot] = _Object->user_data;
+                object_left[_Slot] = _Object->bounds.left;
+                object_top[_Slot] = _Object->bounds.top;
+                object_right[_Slot] = _Object->bounds.right;
+                object_bottom[_Slot] = _Object->bounds.bottom;
+            }
 
-        void remove_empty_nodes();
+            void clear_object(size_t _Slot) {
+                const QuadTreeBox<T> empty = QuadTreeBox<T>::empty();
 
-        size_t level = 1;
-    public:
-        QuadTree() {
-            level = 1;
+                objects[_Slot].reset();
+                payloads[_Slot] = P();
+                object_left[_Slot] = empty.left;
+                object_top[_Slot] = empty.top;
+                object_right[_Slot] = empty.right;
+                object_bottom[_Slot] = empty.bottom;
+            }
+        };
+
+        static constexpr size_t kMaxObjects = std::numeric_limits<uint32_t>::max();
+
+        // all nodes of the tree, siblings are allocated as one block of kChildren
+        pool<Node> nodes;
+        // standing queries whose region the node is the deepest to contain,
+        // index into subscriber_lists
+        pool<node_index> node_subscribers;
+        // max_bounds may be looser than needed after a remove, cleared by refit()
+        pool<uint8_t> node_dirty;
+        // first nodes of sibling blocks released by merge(), reused by split()
+        pool<node_index> free_blocks;
+
+        // object storage of the nodes holding objects, released leaves are
+        // emptied and reused
+        pool<Leaf> leaves;
+        pool<node_index> free_leaves;
+
+        // calls _Fn(const Leaf&, size_t slot) for the objects stored in _Node
+        // itself until it returns false, returns false if it was stopped
+        template <typename _Func>
+        bool for_objects(node_index _Node, _Func&& _Fn) const {
+            const size_t count = nodes[_Node].object_count;
+            size_t seen = 0;
+
+            for (node_index leaf = nodes[_Node].leaf; seen < count; leaf = leaves[leaf].next) {
+                const Leaf& block = leaves[leaf];
+
+                for (size_t i = 0; i < _Capacity && seen < count; i++) {
+                    if (!block.objects[i])
+                        continue;
+
+                    seen++;
+
+                    if (!detail::visit(_Fn, block, i))
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Leaf::scan_objects() over every block of _Node, _Fn(const Leaf&,
+        // size_t slot) is called per hit
+        template <typename _Box, typename _Func>
+        bool scan_node(node_index _Node, const _Box& _Bounds, _Func&& _Fn) const {
+            for (node_index leaf = nodes[_Node].leaf; leaf != kInvalidNode; leaf = leaves[leaf].next) {
+                const Leaf& block = leaves[leaf];
+
+                if (!block.scan_objects(_Bounds, [&](size_t _Slot) { return _Fn(block, _Slot); }))
+                    return false;
+            }
 
-            objects.resize(_Capacity);
-            has_children = false;
-            for (size_t i = 0; i < _Capacity; i++)
-                objects[i].reset();
+            return true;
         }
 
-        QuadTree(const QuadTreeAABB<T>& _Bounds) : bounds(_Bounds), max_bounds(_Bounds) {
-            level = 1;
+        // where each object is stored, keyed by QuadTreeObject::id. the leaf
+        // block knows its node, so moving nodes leaves the map alone
+        struct Location {
+            node_index leaf;
+            uint32_t slot;
+        };
+        std::unordered_map<size_t, Location, std::hash<size_t>, std::equal_to<size_t>,
+            rebind_alloc<std::pair<const size_t, Location>>> locations;
+
+        // standing queries live at the deepest subdividing node containing
+        // their region, a change only checks the lists of the nodes on the
+        // way down to the changed box
+        struct Subscription {
+            QuadTreeBox<T> region;
+            subscription_callback callback;
+            // node whose list holds the subscription, kInvalidNode while unused
+            node_index node = kInvalidNode;
+        };
+        pool<Subscription> subscriptions;
+        pool<uint32_t> free_subscriptions;
+        size_t active_subscriptions = 0;
+
+        pool<pool<uint32_t>> subscriber_lists;
+        pool<node_index> free_subscriber_lists;
+
+        // loose mode is enabled for factors above 1, see set_looseness()
+        double looseness = 0.0;
+        // upper bound of loose_depth(), placement is still limited by kMaxDepth
+        static constexpr size_t kMaxLooseDepth = 64;
+
+        bool is_loose() const { return looseness > 1.0; }
+
+        // resizes the node pool together with its side arrays
+        void resize_nodes(size_t _Count);
+        node_index allocate_block();
+        // an empty block of the leaf pool owned by _Node
+        node_index allocate_leaf(node_index _Node);
+        void acquire_leaf(node_index _Node);
+        // empties and releases every block of _Node
+        void release_leaf(node_index _Node);
+
+        // takes the first free slot of the first block of _Node. a full block
+        // only happens on nodes that cannot split, they get a new first block
+        void place_object(node_index _Node, const object_ptr& _Object);
+        void store_object(node_index _Leaf, size_t _Slot, const object_ptr& _Object);
+        // releases the leaf of its node once the last object is erased. holes
+        // in the full blocks of a chain are filled from the first block
+        void erase_object(node_index _Leaf, size_t _Slot);
+        // hands the objects of a node that was just split down to its children
+        void push_down(node_index _Node);
+        void adjust_total(node_index _Node, ptrdiff_t _Delta);
+
+        // false at kMaxDepth, below kMinSize or once the coordinates cannot
+        // be halved any further. such nodes are never split and keep every
+        // object routed to them in a chain of leaf blocks
+        bool subdivides(node_index _Node) const;
+
+        void split(node_index _Node);
+        void merge(node_index _Node);
+
+        void attach_subscription(uint32_t _Id);
+        void detach_subscription(uint32_t _Id);
+        // appends the subscriptions of _From to the list of _To
+        void move_subscribers(node_index _From, node_index _To);
+        // hands the subscriptions of a node that was just split to the
+        // children containing their regions
+        void push_down_subscriptions(node_index _Node);
+        // drops all lists and homes every subscription again, after build()
+        void rehome_subscriptions();
+
+        // calls _Func(const Subscription&) for the subscriptions whose region
+        // intersects _Bounds
+        template <typename _Func>
+        void for_subscriptions(node_index _Node, const QuadTreeBox<T>& _Bounds, _Func& _Fn) const;
+        // reports enter and leave events for an object that moved from _Old
+        // to _New, either may be null for objects that were not or are no
+        // longer in the tree
+        void notify(const object_ptr& _Object, const QuadTreeBox<T>* _Old, const QuadTreeBox<T>* _New) const;
+        // reports _Event for every object in every subscribed region
+        void notify_all(QuadTreeEvent _Event) const;
+
+        void merge_underfull(node_index _Node);
+        void fit_max_bounds(node_index _Node);
+        void grow_max_bounds(node_index _Node, const QuadTreeBox<T>& _Bounds);
+        void mark_dirty(node_index _Node);
+        void refit(node_index _Node, bool _All);
+
+        // progress of compact()'s post-order walk. the position is kept as
+        // child indices from the root rather than node indices, so it stays
+        // meaningful when the tree changes between steps
+        struct Compaction {
+            std::vector<uint8_t> path;
+            // the children of the current node are done, only its refit is left
+            bool ascending = false;
+            bool active = false;
+        };
+        Compaction compaction;
+
+        // the clock is read once per this many nodes of a compaction step
+        static constexpr size_t kCompactionStride = 64;
+
+        // moves the reachable nodes and leaves into fresh pools in depth-first
+        // order, every sibling block directly before the subtrees of its nodes
+        void relocate();
+
+        // bulk build entries, key is the morton code of the object center
+        // relative to the root bounds
+        struct BuildEntry {
+            uint64_t key;
+            object_ptr object;
+        };
+
+        // quadrant levels encoded in a morton key, 32 bits per axis
+        static constexpr size_t kMortonDepth = 32;
+        // below this many objects build() sorts on the calling thread
+        static constexpr size_t kParallelBuildThreshold = 1 << 16;
+
+        uint64_t morton_key(const QuadTreeAABB<T>& _Bounds) const;
+        void sort_entries(std::vector<BuildEntry>& _Entries) const;
+        void build(node_index _Node, BuildEntry* _First, BuildEntry* _Last, size_t _Depth,
+            std::vector<object_ptr>& _Rejected);
+
+        bool insert(node_index _Node, const object_ptr& _Object);
+        bool insert_loose(node_index _Node, const object_ptr& _Object);
+
+        size_t loose_depth(const QuadTreeAABB<T>& _Bounds) const;
+        bool loose_fits(node_index _Node, const QuadTreeAABB<T>& _Bounds) const;
+        node_index child_by_center(node_index _Node, double _X, double _Y) const;
+        // child of _Node an object with _Bounds is stored in, the first one
+        // it intersects. boxes without area on a center line intersect
+        // none and go by their center
+        node_index child_for(node_index _Node, const QuadTreeAABB<T>& _Bounds) const;
+        bool update(size_t _Id, const QuadTreeAABB<T>& _Bounds, std::vector<node_index>* _Emptied);
+
+        // batch insert work item, a subtree and the objects routed into it.
+        // workers only read the shared tree: objects bound for leaves with
+        // room are placed afterwards, fuller leaves are rebuilt in a private
+        // tree whose nodes are then spliced into the pools
+        struct InsertTask {
+            node_index node;
+            std::vector<object_ptr> objects;
+            // leaves of this tree and the objects they take as they are
+            std::vector<std::pair<node_index, std::vector<object_ptr>>> direct;
+            // roots in the private tree and the leaves they replace
+            std::vector<std::pair<node_index, node_index>> rebuilt;
+        };
+
+        void distribute(node_index _Node, std::vector<object_ptr>& _Objects,
+            size_t _Depth, size_t _TaskDepth, std::vector<InsertTask>& _Tasks);
+        // routes the objects of _Task to the leaves below its node and
+        // rebuilds the leaves that overflow as subtrees of _Scratch
+        void fill_task(InsertTask& _Task, QuadTree& _Scratch) const;
+        // appends the nodes and leaves of _From to the pools, its rebuilt
+        // roots take the place of the leaves they were made for
+        void splice(QuadTree& _From, const std::vector<std::pair<node_index, node_index>>& _Roots);
+
+        template <typename _Visitor>
+        bool query(node_index _Node, const QuadTreeAABB<T>& _Boundaries,
+            _Visitor& _Visit, bool _BoundChecks) const;
+
+        // visitors taking const object_ptr& get the object, all others the
+        // payload stored in the leaf
+        template <typename _Visitor, typename... _Args>
+        using hit_type = std::conditional_t<std::is_invocable_v<_Visitor&, const _Args&...,
+            const object_ptr&>, object_ptr, P>;
+
+        template <typename _Visitor, typename... _Args>
+        static bool visit_slot(_Visitor& _Visit, const Leaf& _Leaf, size_t _Slot, const _Args&... _Arguments) {
+            if constexpr (std::is_same_v<hit_type<_Visitor, _Args...>, object_ptr>)
+                return detail::visit(_Visit, _Arguments..., _Leaf.objects[_Slot]);
+            else
+                return detail::visit(_Visit, _Arguments..., _Leaf.payloads[_Slot]);
+        }
+
+        // parallel queries split the tree into at least this many subtrees per thread
+        static constexpr size_t kTasksPerThread = 4;
+
+        template <typename _Visitor>
+        using pair_type = std::conditional_t<std::is_invocable_v<_Visitor&, const object_ptr&,
+            const object_ptr&>, object_ptr, P>;
+
+        template <typename _Visitor>
+        static bool visit_pair(_Visitor& _Visit, const Leaf& _A, size_t _SlotA, const Leaf& _B, size_t _SlotB) {
+            if constexpr (std::is_same_v<pair_type<_Visitor>, object_ptr>)
+                return detail::visit(_Visit, _A.objects[_SlotA], _B.objects[_SlotB]);
+            else
+                return detail::visit(_Visit, _A.payloads[_SlotA], _B.payloads[_SlotB]);
+        }
+
+        // pair enumeration is split into the pairs within one subtree and
+        // the pairs between two disjoint subtrees. the *_local parts only
+        // cover the objects stored in the given nodes themselves
+        template <typename _Visitor>
+        bool pairs_objects(node_index _Node, node_index _Subtree, _Visitor& _Visit) const;
+        template <typename _Visitor>
+        bool pairs_self_local(node_index _Node, _Visitor& _Visit) const;
+        template <typename _Visitor>
+        bool pairs_cross_local(node_index _A, node_index _B, _Visitor& _Visit) const;
+        template <typename _Visitor>
+        bool pairs_self(node_index _Node, _Visitor& _Visit) const;
+        template <typename _Visitor>
+        bool pairs_cross(node_index _A, node_index _B, _Visitor& _Visit) const;
+
+        template <typename _Visitor>
+        bool query_batch(node_index _Node, const QuadTreeAABB<T>* _Queries,
+            std::vector<uint32_t>& _Active, size_t _Begin, size_t _End, _Visitor& _Visit) const;
+
+        size_t get_total_objects(node_index _Node) const { return nodes[_Node].total_count; }
+
+        struct NearestEntry {
+            double distance;
+            node_index node;
+
+            bool operator>(const NearestEntry& _Other) const { return distance > _Other.distance; }
+        };
+
+        struct Ray {
+            double x, y;
+            double dx, dy;
+            double inv_dx, inv_dy;
+        };
+
+        static Ray make_ray(T _X, T _Y, double _DirX, double _DirY) {
+            return Ray{ (double)_X, (double)_Y, _DirX, _DirY, 1.0 / _DirX, 1.0 / _DirY };
+        }
+
+        // false when _Ray misses _Box within [0, _MaxT], otherwise _Enter is
+        // the parameter at which it enters. edges count as hits
+        static bool ray_entry(const QuadTreeBox<T>& _Box, const Ray& _Ray, double _MaxT, double& _Enter);
+
+        // hits closer than _Limit go to _First, which then shrinks _Limit,
+        // or are all appended to _Hits
+        void raycast(node_index _Node, const Ray& _Ray, double& _Limit, object_ptr* _First,
+            std::vector<std::pair<double, object_ptr>>* _Hits) const;
+
+        // _Region is one of the detail regions, subtrees whose max_bounds
+        // lie inside it are reported by visit_subtree() without tests
+        template <typename _Region, typename _Visitor>
+        bool query_region(node_index _Node, const _Region& _Area, _Visitor& _Visit) const;
+        template <typename _Visitor>
+        bool visit_subtree(node_index _Node, _Visitor& _Visit) const;
+    public:
+        explicit QuadTree(const _Allocator& _Alloc = _Allocator()) :
+            nodes(_Alloc), node_subscribers(_Alloc), node_dirty(_Alloc), free_blocks(_Alloc), leaves(_Alloc), free_leaves(_Alloc),
+            locations(_Alloc), subscriptions(_Alloc), free_subscriptions(_Alloc),
+            subscriber_lists(_Alloc), free_subscriber_lists(_Alloc) {
+            resize_nodes(1);
+        }
+
+        QuadTree(const QuadTreeAABB<T>& _Bounds, const _Allocator& _Alloc = _Allocator()) :
+            QuadTree(_Alloc) {
+            set_bounds(_Bounds);
+        }
 
-            objects.resize(_Capacity);
-            has_children = false;
-            for (size_t i = 0; i < _Capacity; i++)
-                objects[i].reset();
+        // bulk loads [_First, _Last), see build()
+        template <typename _Iterator>
+        QuadTree(const QuadTreeAABB<T>& _Bounds, _Iterator _First, _Iterator _Last,
+            const _Allocator& _Alloc = _Allocator()) :
+            QuadTree(_Alloc) {
+            set_bounds(_Bounds);
+            build(_First, _Last);
         }
 
-        ~QuadTree() {
+        allocator_type get_allocator() const { return allocator_type(nodes.get_allocator()); }
+
+        // creates an object whose shared state comes from the tree's
+        // allocator, so objects can live in the same arena as the tree.
+        // the arena has to outlive every copy of the pointer
+        object_ptr make_object(const QuadTreeAABB<T>& _Bounds, const P& _UserData, size_t _Id) const {
+            return std::allocate_shared<object_type>(rebind_alloc<object_type>(nodes.get_allocator()),
+                _Bounds, _UserData, _Id);
         }
 
         void set_bounds(const QuadTreeAABB<T>& _Bounds) {
-            bounds = _Bounds;
-            max_bounds = _Bounds;
+            nodes[kRootNode].bounds = _Bounds;
+            nodes[kRootNode].max_bounds = _Bounds;
+        }
+
+        // recomputes max_bounds of every node bottom-up
+        void resolve_max_bounds() { refit(kRootNode, true); }
+
+        // merges the subtrees holding no more than the merge threshold,
+        // re-tightens every max_bounds in one bottom-up pass and moves the
+        // nodes and leaves into fresh, exactly sized pools in depth-first
+        // order. released blocks and leaves are dropped
+        void compact() {
+            while (!compact(std::chrono::steady_clock::duration::max())) {}
         }
 
-        void resolve_max_bounds();
+        // runs compact() in steps of about _Budget, returns true once the
+        // pass is complete. the tree may change between steps, subtrees
+        // split after the walk passed them are only tightened by the next
+        // pass. the final relocation always runs as one step
+        bool compact(std::chrono::steady_clock::duration _Budget);
+
+        // switches the tree to a loose quadtree when _Looseness > 1. every
+        // node then accepts objects whose center lies in its bounds and that
+        // fit into its bounds grown by the factor, the depth follows directly
+        // from the object size and the child from the object center. values
+        // of 1 or below restore the default placement. only allowed while
+        // the tree is empty
+        void set_looseness(double _Looseness) {
+            if (get_total_objects() > 0)
+                throw std::logic_error("looseness can only change on an empty tree");
+
+            looseness = _Looseness;
+        }
+
+        double get_looseness() const { return looseness; }
+
+        // insert() only grows max_bounds and remove() just marks the path to
+        // the root dirty, so max_bounds stay conservative but may be loose.
+        // refit() re-tightens the dirty nodes bottom-up
+        void refit() { refit(kRootNode, false); }
+
+        QuadTreeAABB<T> get_bounds(node_index _Node = kRootNode) const {
+            return nodes[_Node].bounds.to_aabb();
+        }
+
+        QuadTreeAABB<T> get_max_bounds(node_index _Node = kRootNode) const {
+            return nodes[_Node].max_bounds.to_aabb();
+        }
+
+        // returns false if the object is outside the tree bounds or an
+        // object with the same id is already stored
+        bool insert(const object_ptr& _Object) {
+            if (locations.count(_Object->id))
+                return false;
 
-        const QuadTreeAABB<T>& get_bounds() const {
-            return bounds;
+            if (!insert(kRootNode, _Object))
+                return false;
+
+            if (active_subscriptions > 0) {
+                const QuadTreeBox<T> bounds(_Object->bounds);
+                notify(_Object, nullptr, &bounds);
+            }
+            return true;
+        }
+
+        // replaces the contents of the tree with the objects of a range of
+        // object_ptr. objects are sorted by the
+        // morton code of their center and the hierarchy and max_bounds are
+        // built bottom-up in one pass. returns the number of objects stored,
+        // objects outside the tree bounds are skipped
+        template <typename _Iterator>
+        size_t build(_Iterator _First, _Iterator _Last);
+
+        // inserts a range of object_ptr into the
+        // existing tree. objects are routed down by the same rule as insert()
+        // until the subtrees they fall into can be filled independently on
+        // _Threads threads (all hardware threads when 0). existing nodes stay
+        // where they are, only leaves that overflow are rebuilt and their new
+        // subtrees appended to the pools. returns the number of objects
+        // inserted
+        template <typename _Iterator>
+        size_t insert_batch(_Iterator _First, _Iterator _Last, size_t _Threads = 0);
+
+        // objects are located through their id, removal does not search the tree
+        bool remove(const object_ptr& _Object) {
+            return remove(_Object->id);
         }
 
-        const QuadTreeAABB<T>& get_max_bounds() const {
-            return max_bounds;
+        bool remove(size_t _Id);
+
+        // moves the object to _Bounds, updating the object's bounds. the
+        // object stays in its node while it still intersects it, otherwise it
+        // is reinserted from the nearest ancestor containing _Bounds. if
+        // _Bounds is outside the tree the object is removed and false returned
+        bool update(size_t _Id, const QuadTreeAABB<T>& _Bounds) {
+            return update(_Id, _Bounds, nullptr);
+        }
+
+        bool update(const object_ptr& _Object, const QuadTreeAABB<T>& _Bounds) {
+            return update(_Object->id, _Bounds, nullptr);
         }
 
-        bool insert(const std::shared_ptr<QuadTreeObject<T>>& _Object);
-        bool remove(const std::shared_ptr<QuadTreeObject<T>>& _Object);
+        // applies a range of std::pair<size_t, QuadTreeAABB<T>> (id, new
+        // bounds) like update(), merging emptied nodes once at the end of the
+        // batch. returns the number of objects that are still in the tree
+        template <typename _Iterator>
+        size_t update_many(_Iterator _First, _Iterator _Last);
+
+        // registers a standing query. _Callback(const object_ptr&, QuadTreeEvent)
+        // is called with enter whenever an object starts to intersect _Region
+        // through insert(), insert_batch(), build() or update(), and with
+        // leave when it stops to intersect it or is removed. the objects
+        // already intersecting _Region are reported as enter right away.
+        // calls happen after the change is complete and must not modify the
+        // tree or its subscriptions. returns the id of the subscription
+        size_t subscribe(const QuadTreeAABB<T>& _Region, subscription_callback _Callback);
+
+        // moves a subscription to _Region, reporting the objects that only
+        // intersect the old region as leave and those that only intersect
+        // the new one as enter. returns false for unknown ids
+        bool move_subscription(size_t _Id, const QuadTreeAABB<T>& _Region);
+
+        // drops a subscription without reporting any events
+        bool unsubscribe(size_t _Id);
+
+        size_t get_subscription_count() const { return active_subscriptions; }
+
+        // stored object with the given id, empty if there is none
+        object_ptr find(size_t _Id) const {
+            auto it = locations.find(_Id);
+            if (it == locations.end())
+                return nullptr;
+
+            return leaves[it->second.leaf].objects[it->second.slot];
+        }
 
+        // _Objects must have room for every result, prefer the overload
+        // taking _MaxObjects
         void query(const QuadTreeAABB<T>& _Boundaries,
-            std::shared_ptr<QuadTreeObject<T>>* _Objects, size_t& _Length,
-            bool _BoundChecks = true) const;
+            object_ptr* _Objects, size_t& _Length,
+            bool _BoundChecks = true) const {
+            auto append = [&](const object_ptr& _Object) {
+                _Objects[_Length++] = _Object;
+            };
+            query(kRootNode, _Boundaries, append, _BoundChecks);
+        }
+
+        // _MaxObjects is the capacity of _Objects. results are written
+        // starting at _Objects[_Length] and writing stops once _Length
+        // reaches _MaxObjects, returns false if results had to be dropped
+        bool query(const QuadTreeAABB<T>& _Boundaries,
+            object_ptr* _Objects, size_t _MaxObjects, size_t& _Length,
+            bool _BoundChecks = true) const {
+            auto append = [&](const object_ptr& _Object) {
+                if (_Length >= _MaxObjects)
+                    return false;
+
+                _Objects[_Length++] = _Object;
+                return true;
+            };
+            return query(kRootNode, _Boundaries, append, _BoundChecks);
+        }
+
+        // _Objects may use any allocator, an arena backed vector for example
+        template <typename _Alloc>
         void query(const QuadTreeAABB<T>& _Boundaries,
-            std::vector<std::shared_ptr<QuadTreeObject<T>>>& _Objects,
-            bool _BoundChecks = true) const;
+            std::vector<object_ptr, _Alloc>& _Objects,
+            bool _BoundChecks = true) const {
+            auto append = [&](const object_ptr& _Object) {
+                _Objects.push_back(_Object);
+            };
+            query(kRootNode, _Boundaries, append, _BoundChecks);
+        }
 
-        bool has_children_() const { return has_children; }
+        // calls _Visit(const object_ptr&) for every object intersecting
+        // _Boundaries without copying the pointer, or _Visit(const P&) with
+        // the payload copied into the leaf. the visitor may return false to
+        // stop early, in which case query() returns false
+        template <typename _Visitor, typename = std::enable_if_t<std::is_invocable_v<_Visitor&,
+            const object_ptr&> || std::is_invocable_v<_Visitor&, const P&>>>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit,
+            bool _BoundChecks = true) const {
+            return query(kRootNode, _Boundaries, _Visit, _BoundChecks);
+        }
 
-        const std::vector<std::shared_ptr<QuadTree<T, _Capacity>>>& get_children() const { return children; }
+        bool has_children_(node_index _Node = kRootNode) const { return nodes[_Node].has_children(); }
 
-        size_t get_total_objects() const;
-    };
+        // first of the four contiguous children of _Node, kInvalidNode for leaves
+        node_index get_children(node_index _Node = kRootNode) const { return nodes[_Node].children; }
 
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::split()
-    {
-        if (!has_children) {
-            QuadTreeAABB<T> child_aabb;
-
-            children.resize(kChildren);
-            // top left
-            child_aabb.left = bounds.left;
-            child_aabb.top = bounds.top;
-            child_aabb.right = bounds.x;
-            child_aabb.bottom = bounds.y;
-            child_aabb.set_center();
-            child_aabb.set_dimensions();
-            children[0] = std::make_shared<QuadTree<T, _Capacity>>(child_aabb);
-            children[0]->level = level + 1;
-            children[0]->root = shared_from_this();
-            // top right
-            child_aabb.left = bounds.x;
-            child_aabb.top = bounds.top;
-            child_aabb.right = bounds.right;
-            child_aabb.bottom = bounds.y;
-            child_aabb.set_center();
-            child_aabb.set_dimensions();
-            children[1] = std::make_shared<QuadTree<T, _Capacity>>(child_aabb);
-            children[1]->set_bounds(child_aabb);
-            children[1]->level = level + 1;
-            children[1]->root = shared_from_this();
-            // bottom right
-            child_aabb.left = bounds.x;
-            child_aabb.top = bounds.y;
-            child_aabb.right = bounds.right;
-            child_aabb.bottom = bounds.bottom;
-            child_aabb.set_center();
-            child_aabb.set_dimensions();
-            children[2] = std::make_shared<QuadTree<T, _Capacity>>(child_aabb);
-            children[2]->set_bounds(child_aabb);
-            children[2]->level = level + 1;
-            children[2]->root = shared_from_this();
-            // bottom left
-            child_aabb.left = bounds.left;
-            child_aabb.top = bounds.y;
-            child_aabb.right = bounds.x;
-            child_aabb.bottom = bounds.bottom;
-            child_aabb.set_center();
-            child_aabb.set_dimensions();
-            children[3] = std::make_shared<QuadTree<T, _Capacity>>(child_aabb);
-            children[3]->set_bounds(child_aabb);
-            children[3]->level = level + 1;
-            children[3]->root = shared_from_this();
-
-            has_children = true;
-        }
-    }
-
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::merge()
-    {
-        if (has_children) {
-            children[0]->merge();
-            children[1]->merge();
-            children[2]->merge();
-            children[3]->merge();
-
-            children.clear();
-
-            has_children = false;
-        }
-    }
-
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::remove_empty_nodes()
-    {
-        if (has_children) {
-            children[0]->remove_empty_nodes();
-            children[1]->remove_empty_nodes();
-            children[2]->remove_empty_nodes();
-            children[3]->remove_empty_nodes();
-
-            if (get_total_objects() < 1)
-                merge();
-        }
-    }
-
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::resolve_max_bounds()
-    {
-        max_bounds = bounds; 
+        size_t get_level(node_index _Node = kRootNode) const { return nodes[_Node].level; }
 
-        for (size_t i = 0; i < _Capacity; i++) {
-            if (objects[i]) {
-                max_bounds.left = std::min(max_bounds.left, objects[i]->bounds.left);
-                max_bounds.top = std::min(max_bounds.top, objects[i]->bounds.top);
-                max_bounds.right = std::max(max_bounds.right, objects[i]->bounds.right);
-                max_bounds.bottom = std::max(max_bounds.bottom, objects[i]->bounds.bottom);
+        // number of objects stored in _Node itself, not counting descendants
+        size_t get_object_count(node_index _Node = kRootNode) const { return nodes[_Node].object_count; }
 
-                if (!max_bounds.verify()) {
-                    throw std::exception("invalid bounds");
-                }
-            }
+        // calls _Visit(const object_ptr&) for the objects stored in _Node itself
+        template <typename _Visitor>
+        void visit_objects(node_index _Node, _Visitor&& _Visit) const {
+            for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+                _Visit(static_cast<const object_ptr&>(_Leaf.objects[_Slot]));
+            });
         }
 
-        if (has_children) {
-            for (size_t i = 0; i < kChildren; i++) {
-                max_bounds.left = std::min(max_bounds.left, children[i]->max_bounds.left);
-                max_bounds.top = std::min(max_bounds.top, children[i]->max_bounds.top);
-                max_bounds.right = std::max(max_bounds.right, children[i]->max_bounds.right);
-                max_bounds.bottom = std::max(max_bounds.bottom, children[i]->max_bounds.bottom);
+        // number of pool slots in use, including released blocks waiting for reuse
+        size_t get_node_count() const { return nodes.size(); }
+
+        // walks the reachable nodes, cost is linear in the tree size
+        QuadTreeStats stats() const;
+
+        size_t get_total_objects() const { return get_total_objects(kRootNode); }
+
+        // answers _Count queries in one traversal. each node is visited once
+        // for all queries overlapping its max_bounds and _Visit(size_t query,
+        // const object_ptr&) or _Visit(size_t query, const P&) is called per hit. queries are ordered along a morton curve first and
+        // split into spatially coherent chunks when running on several
+        // threads, in which case _Visit must be thread safe. returns false
+        // if the visitor stopped the batch
+        template <typename _Visitor>
+        bool query_batch(const QuadTreeAABB<T>* _Queries, size_t _Count, _Visitor&& _Visit,
+            size_t _Threads = 1) const;
+
+        // like query() but spreads the overlapping subtrees over _Threads
+        // threads (all hardware threads when 0), _Visit must be thread safe.
+        // pays off for queries touching a large part of the tree
+        template <typename _Visitor>
+        bool query_parallel(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit,
+            size_t _Threads = 0) const;
+
+        // finds the _K objects closest to (_X, _Y) within _MaxRadius, measured
+        // to the object bounds. the results are written to _Objects and
+        // _Distances (both room for _K) ordered by distance, returns how many
+        // were found. nodes are expanded best first by their max_bounds
+        // distance, so only the nodes that can still improve the result are
+        // visited
+        size_t nearest(T _X, T _Y, size_t _K, object_ptr* _Objects, double* _Distances,
+            double _MaxRadius = std::numeric_limits<double>::infinity()) const;
+
+        // closest object to (_X, _Y) within _MaxRadius, nullptr if none
+        object_ptr nearest(T _X, T _Y,
+            double _MaxRadius = std::numeric_limits<double>::infinity()) const {
+            object_ptr object;
+            double distance;
+            nearest(_X, _Y, 1, &object, &distance, _MaxRadius);
+            return object;
+        }
 
-                if (!max_bounds.verify()) {
-                    throw std::exception("invalid bounds");
-                }
-            }
+        // calls _Visit(a, b) once for every pair of intersecting objects, with
+        // const object_ptr& or const P& arguments. a node's objects are
+        // paired with each other, with its descendants and sibling subtrees
+        // with each other, pruned by max_bounds. with several _Threads (all
+        // hardware threads when 0) independent subtree pairs run in
+        // parallel and _Visit must be thread safe. returns false if the
+        // visitor stopped the enumeration
+        template <typename _Visitor>
+        bool all_pairs(_Visitor&& _Visit, size_t _Threads = 1) const;
+
+        // first object hit by the ray (_X, _Y) + t * (_DirX, _DirY) for t in
+        // [0, _MaxT], nullptr if none. t is in units of the direction length
+        // and stored to _HitT. children are walked front to back and skipped
+        // once the ray enters their max_bounds behind the closest hit. a
+        // segment from a to b is the ray from a along b - a with _MaxT = 1
+        object_ptr raycast(T _X, T _Y, double _DirX, double _DirY,
+            double _MaxT = std::numeric_limits<double>::infinity(), double* _HitT = nullptr) const {
+            object_ptr first;
+            double limit = _MaxT;
+
+            raycast(kRootNode, make_ray(_X, _Y, _DirX, _DirY), limit, &first, nullptr);
+
+            if (first && _HitT)
+                *_HitT = limit;
+            return first;
         }
 
-        max_bounds.set_center();
-        max_bounds.set_dimensions();
-        
-        if (root)
-            root->resolve_max_bounds();
-    }
+        // calls _Visit(const object_ptr&) or _Visit(const P&) for every
+        // object intersecting the disc of _Radius around (_X, _Y). the
+        // visitor may return false to stop, query_circle() then returns false
+        template <typename _Visitor>
+        bool query_circle(T _X, T _Y, double _Radius, _Visitor&& _Visit) const {
+            return query_region(kRootNode, detail::CircleRegion(_X, _Y, _Radius), _Visit);
+        }
+
+        template <typename _Alloc>
+        void query_circle(T _X, T _Y, double _Radius, std::vector<object_ptr, _Alloc>& _Objects) const {
+            auto append = [&](const object_ptr& _Object) {
+                _Objects.push_back(_Object);
+            };
+            query_region(kRootNode, detail::CircleRegion(_X, _Y, _Radius), append);
+        }
+
+        // same for a convex polygon given by its vertices as (x, y) in
+        // either winding order, a view frustum for example
+        template <typename _Visitor>
+        bool query_convex(const std::vector<std::pair<T, T>>& _Polygon, _Visitor&& _Visit) const {
+            return query_region(kRootNode, detail::ConvexRegion(_Polygon), _Visit);
+        }
+
+        template <typename _Alloc>
+        void query_convex(const std::vector<std::pair<T, T>>& _Polygon, std::vector<object_ptr, _Alloc>& _Objects) const {
+            auto append = [&](const object_ptr& _Object) {
+                _Objects.push_back(_Object);
+            };
+            query_region(kRootNode, detail::ConvexRegion(_Polygon), append);
+        }
+
+        // appends every hit as (t, object) to _Hits ordered by t, returns
+        // the number of hits added
+        size_t raycast(T _X, T _Y, double _DirX, double _DirY, double _MaxT,
+            std::vector<std::pair<double, object_ptr>>& _Hits) const {
+            const size_t begin = _Hits.size();
+            double limit = _MaxT;
+
+            raycast(kRootNode, make_ray(_X, _Y, _DirX, _DirY), limit, nullptr, &_Hits);
+
+            std::sort(_Hits.begin() + begin, _Hits.end(),
+                [](const std::pair<double, object_ptr>& _A, const std::pair<double, object_ptr>& _B) {
+                    return _A.first < _B.first;
+                });
+            return _Hits.size() - begin;
+        }
+    };
 
-    template<typename T, size_t _Capacity>
-    inline bool QuadTree<T, _Capacity>::insert(const std::shared_ptr<QuadTreeObject<T>>& _Object)
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::pairs_objects(node_index _Node, node_index _Subtree,
+        _Visitor& _Visit) const
     {
-        if (bounds.intersects(_Object->bounds)) {
-            if (object_count >= _Capacity) {
-                if (!has_children)
-                    split();
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+        const Node& subtree = nodes[_Subtree];
 
-                if (!children[0]->insert(_Object) 
-                    && !children[1]->insert(_Object)
-                    && !children[2]->insert(_Object)
-                    && !children[3]->insert(_Object))
-                    throw std::out_of_range("object position out of range");
+        if (subtree.total_count == 0)
+            return true;
 
+        bool overlaps = false;
+
+        if (!for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            const QuadTreeBox<T> bounds = _Leaf.object_bounds(_Slot);
+            if (!subtree.max_bounds.intersects(bounds))
                 return true;
-            }
-            else {
-                for (size_t i = 0; i < _Capacity; i++) {
-                    if (!objects[i]) {
-                        objects[i] = _Object;
 
-                        object_count++;
+            overlaps = true;
 
-                        resolve_max_bounds();
-                        return true;
-                    }
-                }
-            }
+            return scan_node(_Subtree, bounds, [&](const Leaf& _Other, size_t _OtherSlot) {
+                return visit_pair(_Visit, _Leaf, _Slot, _Other, _OtherSlot);
+            });
+        }))
+            return false;
+
+        if (!overlaps || !subtree.has_children())
+            return true;
+
+        for (size_t i = 0; i < kChildren; i++) {
+            if (!pairs_objects(_Node, subtree.children + static_cast<node_index>(i), _Visit))
+                return false;
         }
 
-        return false;
+        return true;
     }
 
-    template<typename T, size_t _Capacity>
-    inline bool QuadTree<T, _Capacity>::remove(const std::shared_ptr<QuadTreeObject<T>>& _Object)
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::pairs_self_local(node_index _Node, _Visitor& _Visit) const
     {
-        if (bounds.intersects(_Object->bounds)) {
-            if (object_count > 0) {
-                for (size_t i = 0; i < _Capacity; i++) {
-                    if (objects[i] && objects[i]->id == _Object->id) {
-                        objects[i].reset();
-                        object_count--;
-                        remove_empty_nodes();
+        const Node& node = nodes[_Node];
 
-                        resolve_max_bounds();
+        // each object against the later slots of its block and the blocks
+        // chained behind it
+        if (!for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            const QuadTreeBox<T> bounds = _Leaf.object_bounds(_Slot);
 
-                        return true;
-                    }
-                }
-            }
-            
-            if (has_children) {
-                if (!children[0]->remove(_Object)
-                    && !children[1]->remove(_Object)
-                    && !children[2]->remove(_Object)
-                    && !children[3]->remove(_Object))
+            for (const Leaf* block = &_Leaf; ; block = &leaves[block->next]) {
+                if (!block->scan_objects(bounds, [&](size_t _Other) {
+                    return (block == &_Leaf && _Other <= _Slot) || visit_pair(_Visit, _Leaf, _Slot, *block, _Other);
+                }))
                     return false;
 
-                return true;
+                if (block->next == kInvalidNode)
+                    return true;
             }
-
-        }
-        else {
+        }))
             return false;
+
+        if (node.has_children()) {
+            for (size_t i = 0; i < kChildren; i++) {
+                if (!pairs_objects(_Node, node.children + static_cast<node_index>(i), _Visit))
+                    return false;
+            }
         }
+
+        return true;
     }
 
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::query(const QuadTreeAABB<T>& _Bounds, 
-        std::shared_ptr<QuadTreeObject<T>>* _Objects, size_t& _Length, bool _BoundChecks) const
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::pairs_cross_local(node_index _A, node_index _B,
+        _Visitor& _Visit) const
     {
-        if (max_bounds.intersects(_Bounds) || !_BoundChecks) {
-            if (has_children) {
-                children[0]->query(_Bounds, _Objects, _Length, _BoundChecks);
-                children[1]->query(_Bounds, _Objects, _Length, _BoundChecks);
-                children[2]->query(_Bounds, _Objects, _Length, _BoundChecks);
-                children[3]->query(_Bounds, _Objects, _Length, _BoundChecks);
-            }
+        const Node& a = nodes[_A];
+        const Node& b = nodes[_B];
 
-            if (object_count < 1)
-                return;
+        // the objects of both nodes against the whole other subtree, which
+        // includes the other node's own objects once
+        if (a.object_count > 0 && !pairs_objects(_A, _B, _Visit))
+            return false;
 
-            for (size_t i = 0; i < _Capacity; i++) {
-                if (objects[i] && objects[i]->bounds.intersects(_Bounds)) {
-                    _Objects[_Length++] = objects[i];
-                }
+        if (b.object_count > 0 && a.has_children()) {
+            for (size_t i = 0; i < kChildren; i++) {
+                if (!pairs_objects(_B, a.children + static_cast<node_index>(i), _Visit))
+                    return false;
             }
         }
+
+        return true;
     }
 
-    template<typename T, size_t _Capacity>
-    inline void QuadTree<T, _Capacity>::query(const QuadTreeAABB<T>& _Bounds,
-        std::vector<std::shared_ptr<QuadTreeObject<T>>>& _Objects, bool _BoundChecks) const
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::pairs_self(node_index _Node, _Visitor& _Visit) const
     {
-        if (max_bounds.intersects(_Bounds) || !_BoundChecks) {
-            if (has_children) {
-                children[0]->query(_Bounds, _Objects, _BoundChecks);
-                children[1]->query(_Bounds, _Objects, _BoundChecks);
-                children[2]->query(_Bounds, _Objects, _BoundChecks);
-                children[3]->query(_Bounds, _Objects, _BoundChecks);
-            }
+        const Node& node = nodes[_Node];
 
-            if (object_count < 1)
-                return;
+        if (node.total_count < 2)
+            return true;
 
-            for (size_t i = 0; i < _Capacity; i++) {
-                if (objects[i] && objects[i]->bounds.intersects(_Bounds)) {
-                    _Objects.push_back(objects[i]);
-                }
+        if (!pairs_self_local(_Node, _Visit))
+            return false;
+
+        if (!node.has_children())
+            return true;
+
+        for (size_t i = 0; i < kChildren; i++) {
+            if (!pairs_self(node.children + static_cast<node_index>(i), _Visit))
+                return false;
+
+            for (size_t j = i + 1; j < kChildren; j++) {
+                if (!pairs_cross(node.children + static_cast<node_index>(i),
+                    node.children + static_cast<node_index>(j), _Visit))
+                    return false;
             }
         }
+
+        return true;
     }
 
-    template<typename T, size_t _Capacity>
-    inline size_t QuadTree<T, _Capacity>::get_total_objects() const
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::pairs_cross(node_index _A, node_index _B,
+        _Visitor& _Visit) const
     {
-        size_t obj_count = object_count;
+        const Node& a = nodes[_A];
+        const Node& b = nodes[_B];
+
+        if (a.total_count == 0 || b.total_count == 0 || !a.max_bounds.intersects(b.max_bounds))
+            return true;
+
+        if (!pairs_cross_local(_A, _B, _Visit))
+            return false;
 
-        if (has_children) {
-            obj_count += children[0]->get_total_objects() +
-                children[1]->get_total_objects() +
-                children[2]->get_total_objects() +
-                children[3]->get_total_objects();
+        if (!a.has_children() || !b.has_children())
+            return true;
+
+        for (size_t i = 0; i < kChildren; i++) {
+            for (size_t j = 0; j < kChildren; j++) {
+                if (!pairs_cross(a.children + static_cast<node_index>(i),
+                    b.children + static_cast<node_index>(j), _Visit))
+                    return false;
+            }
         }
 
-        return obj_count;
+        return true;
     }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::all_pairs(_Visitor&& _Visit, size_t _Threads) const
+    {
+        if (_Threads == 0)
+            _Threads = detail::default_threads();
+
+        if (_Threads < 2)
+            return pairs_self(kRootNode, _Visit);
+
+        std::atomic<bool> running(true);
+
+        auto stoppable = [&](const pair_type<_Visitor>& _A, const pair_type<_Visitor>& _B) {
+            return running.load(std::memory_order_relaxed) && detail::visit(_Visit, _A, _B);
+        };
+
+        // expand self and cross tasks breadth first on the calling thread,
+        // doing their local pairs right away, until there is enough work for
+        // every thread. a self task has both nodes equal
+        std::vector<std::pair<node_index, node_index>> tasks{ { kRootNode, kRootNode } };
+
+        for (size_t next = 0; next < tasks.size()
+            && tasks.size() - next < _Threads * kTasksPerThread; next++) {
+            const node_index a = tasks[next].first;
+            const node_index b = tasks[next].second;
+
+            if (a == b) {
+                const Node& node = nodes[a];
+
+                if (node.total_count < 2 || !node.has_children())
+                    continue;
+
+                if (!pairs_self_local(a, stoppable))
+                    return running = false;
+
+                for (size_t i = 0; i < kChildren; i++) {
+                    tasks.emplace_back(node.children + i, node.children + i);
+
+                    for (size_t j = i + 1; j < kChildren; j++)
+                        tasks.emplace_back(node.children + i, node.children + j);
+                }
+            }
+            else {
+                const Node& node_a = nodes[a];
+                const Node& node_b = nodes[b];
+
+                if (!node_a.has_children() || !node_b.has_children())
+                    continue;
+
+                if (node_a.total_count == 0 || node_b.total_count == 0
+                    || !node_a.max_bounds.intersects(node_b.max_bounds)) {
+                    tasks[next] = { kInvalidNode, kInvalidNode };
+                    continue;
+                }
+
+                if (!pairs_cross_local(a, b, stoppable))
+                    return running = false;
+
+                for (size_t i = 0; i < kChildren; i++) {
+                    for (size_t j = 0; j < kChildren; j++)
+                        tasks.emplace_back(node_a.children + i, node_b.children + j);
+                }
+            }
+
+            tasks[next] = { kInvalidNode, kInvalidNode };
+        }
+
+        tasks.erase(std::remove(tasks.begin(), tasks.end(),
+            std::pair<node_index, node_index>(kInvalidNode, kInvalidNode)), tasks.end());
+
+        detail::parallel_for(tasks.size(), _Threads, [&](size_t _Task) {
+            const node_index a = tasks[_Task].first;
+            const node_index b = tasks[_Task].second;
+
+            if (!running.load(std::memory_order_relaxed))
+                return;
+
+            if (!(a == b ? pairs_self(a, stoppable) : pairs_cross(a, b, stoppable)))
+                running = false;
+        });
+
+        return running;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline QuadTreeStats QuadTree<T, _Capacity, P, _Policy, _Allocator>::stats() const
+    {
+        QuadTreeStats result;
+
+        std::vector<node_index> stack{ kRootNode };
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+
+            const size_t depth = node.level - nodes[kRootNode].level;
+            if (result.depth_histogram.size() <= depth)
+                result.depth_histogram.resize(depth + 1);
+
+            result.depth_histogram[depth]++;
+            result.max_depth = std::max(result.max_depth, depth);
+            result.nodes++;
+            result.objects += node.object_count;
+            for (node_index leaf = node.leaf; leaf != kInvalidNode; leaf = leaves[leaf].next) {
+                result.slots += _Capacity;
+                if (leaf != node.leaf)
+                    result.overflow_leaves++;
+            }
+
+            if (node.has_children()) {
+                for (size_t i = 0; i < kChildren; i++)
+                    stack.push_back(node.children + static_cast<node_index>(i));
+            }
+            else {
+                result.leaves++;
+            }
+        }
+
+        result.free_nodes = free_blocks.size() * kChildren;
+        result.fill_ratio = result.slots > 0 ? (double)result.objects / (double)result.slots : 0.0;
+
+        // a make_shared block holds the object next to a vtable pointer and
+        // both reference counts
+        const size_t control_block = sizeof(void*) + 2 * sizeof(int32_t);
+        // unordered_map nodes carry a next pointer and, for size_t keys, no
+        // cached hash, plus one pointer per bucket
+        const size_t index_entry = sizeof(void*) + sizeof(typename decltype(locations)::value_type);
+
+        result.node_bytes = nodes.capacity() * sizeof(Node) + free_blocks.capacity() * sizeof(node_index)
+            + node_subscribers.capacity() * sizeof(node_index) + node_dirty.capacity()
+            + leaves.capacity() * sizeof(Leaf) + free_leaves.capacity() * sizeof(node_index);
+        result.object_bytes = result.objects * (sizeof(object_type) + control_block);
+        result.index_bytes = locations.size() * index_entry + locations.bucket_count() * sizeof(void*);
+        result.total_bytes = sizeof(*this) + result.node_bytes + result.object_bytes + result.index_bytes;
+        return result;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::ray_entry(const QuadTreeBox<T>& _Box,
+        const Ray& _Ray, double _MaxT, double& _Enter)
+    {
+        double enter = 0.0;
+        double leave = _MaxT;
+
+        // slab test per axis, rays parallel to an axis must start inside its slab
+        if (_Ray.dx != 0.0) {
+            double t0 = ((double)_Box.left - _Ray.x) * _Ray.inv_dx;
+            double t1 = ((double)_Box.right - _Ray.x) * _Ray.inv_dx;
+            if (t0 > t1)
+                std::swap(t0, t1);
+
+            enter = std::max(enter, t0);
+            leave = std::min(leave, t1);
+        }
+        else if (_Ray.x < _Box.left || _Ray.x > _Box.right) {
+            return false;
+        }
+
+        if (_Ray.dy != 0.0) {
+            double t0 = ((double)_Box.top - _Ray.y) * _Ray.inv_dy;
+            double t1 = ((double)_Box.bottom - _Ray.y) * _Ray.inv_dy;
+            if (t0 > t1)
+                std::swap(t0, t1);
+
+            enter = std::max(enter, t0);
+            leave = std::min(leave, t1);
+        }
+        else if (_Ray.y < _Box.top || _Ray.y > _Box.bottom) {
+            return false;
+        }
+
+        _Enter = enter;
+        return enter <= leave;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::visit_subtree(node_index _Node, _Visitor& _Visit) const
+    {
+        const Node& node = nodes[_Node];
+
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+
+        if (!for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            return visit_slot(_Visit, _Leaf, _Slot);
+        }))
+            return false;
+
+        if (node.has_children() && node.total_count > node.object_count) {
+            for (size_t i = 0; i < kChildren; i++) {
+                if (!visit_subtree(node.children + static_cast<node_index>(i), _Visit))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Region, typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::query_region(node_index _Node, const _Region& _Area,
+        _Visitor& _Visit) const
+    {
+        const Node& node = nodes[_Node];
+
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+        NC_QUADTREE_COUNT(intersection_tests, 1);
+
+        if (node.total_count == 0)
+            return true;
+
+        switch (_Area.classify(node.max_bounds)) {
+        case detail::Overlap::outside:
+            return true;
+        case detail::Overlap::inside:
+            return visit_subtree(_Node, _Visit);
+        default:
+            break;
+        }
+
+        NC_QUADTREE_COUNT(intersection_tests, node.object_count);
+
+        if (!for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            return !_Area.intersects(_Leaf.object_bounds(_Slot)) || visit_slot(_Visit, _Leaf, _Slot);
+        }))
+            return false;
+
+        if (node.has_children()) {
+            for (size_t i = 0; i < kChildren; i++) {
+                if (!query_region(node.children + static_cast<node_index>(i), _Area, _Visit))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::raycast(node_index _Node, const Ray& _Ray,
+        double& _Limit, object_ptr* _First, std::vector<std::pair<double, object_ptr>>* _Hits) const
+    {
+        const Node& node = nodes[_Node];
+
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+        NC_QUADTREE_COUNT(intersection_tests, 1);
+
+        // an infinite limit never prunes by comparison, misses are explicit
+        double entry;
+        if (node.total_count == 0 || !ray_entry(node.max_bounds, _Ray, _Limit, entry))
+            return;
+
+        for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            double t;
+            if (!ray_entry(_Leaf.object_bounds(_Slot), _Ray, _Limit, t))
+                return;
+
+            if (_Hits) {
+                _Hits->emplace_back(t, _Leaf.objects[_Slot]);
+            }
+            else if (!*_First || t < _Limit) {
+                *_First = _Leaf.objects[_Slot];
+                _Limit = t;
+            }
+        });
+
+        if (!node.has_children())
+            return;
+
+        // the child holding the ray origin side comes first and the opposite
+        // one last, the other two go by which center line the ray crosses first
+        const double cx = node.bounds.center_x();
+        const double cy = node.bounds.center_y();
+
+        const size_t column = _Ray.dx < 0.0 || (_Ray.dx == 0.0 && _Ray.x >= cx) ? 1 : 0;
+        const size_t row = _Ray.dy < 0.0 || (_Ray.dy == 0.0 && _Ray.y >= cy) ? 1 : 0;
+
+        // children are ordered top left, top right, bottom right, bottom left
+        static constexpr node_index kQuadrant[2][2] = { { 0, 1 }, { 3, 2 } };
+
+        const double cross_x = _Ray.dx != 0.0 ? (cx - _Ray.x) * _Ray.inv_dx : std::numeric_limits<double>::infinity();
+        const double cross_y = _Ray.dy != 0.0 ? (cy - _Ray.y) * _Ray.inv_dy : std::numeric_limits<double>::infinity();
+
+        const node_index order[kChildren] = {
+            kQuadrant[row][column],
+            cross_x < cross_y ? kQuadrant[row][column ^ 1] : kQuadrant[row ^ 1][column],
+            cross_x < cross_y ? kQuadrant[row ^ 1][column] : kQuadrant[row][column ^ 1],
+            kQuadrant[row ^ 1][column ^ 1]
+        };
+
+        for (size_t i = 0; i < kChildren; i++)
+            raycast(node.children + order[i], _Ray, _Limit, _First, _Hits);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::nearest(T _X, T _Y, size_t _K,
+        object_ptr* _Objects, double* _Distances, double _MaxRadius) const
+    {
+        if (_K == 0 || nodes[kRootNode].total_count == 0)
+            return 0;
+
+        // the node heap is reused across calls on the same thread
+        static thread_local std::vector<NearestEntry> heap;
+        heap.clear();
+
+        // results are kept sorted, _Distances holds squared distances until the end
+        size_t found = 0;
+        double limit = _MaxRadius * _MaxRadius;
+
+        auto push = [&](node_index _Node) {
+            const double distance = nodes[_Node].max_bounds.distance_squared(_X, _Y);
+
+            if (nodes[_Node].total_count > 0 && distance <= limit) {
+                heap.push_back(NearestEntry{ distance, _Node });
+                std::push_heap(heap.begin(), heap.end(), std::greater<NearestEntry>());
+            }
+        };
+
+        push(kRootNode);
+
+        while (!heap.empty()) {
+            const NearestEntry entry = heap.front();
+            std::pop_heap(heap.begin(), heap.end(), std::greater<NearestEntry>());
+            heap.pop_back();
+
+            // every remaining node is at least this far away
+            if (entry.distance > limit)
+                break;
+
+            const Node& node = nodes[entry.node];
+            NC_QUADTREE_COUNT(nodes_visited, 1);
+
+            for_objects(entry.node, [&](const Leaf& _Leaf, size_t _Slot) {
+                const double distance = _Leaf.object_bounds(_Slot).distance_squared(_X, _Y);
+                if (distance > limit || (found == _K && distance >= _Distances[found - 1]))
+                    return;
+
+                size_t slot = found < _K ? found++ : found - 1;
+                for (; slot > 0 && _Distances[slot - 1] > distance; slot--) {
+                    _Objects[slot] = std::move(_Objects[slot - 1]);
+                    _Distances[slot] = _Distances[slot - 1];
+                }
+
+                _Objects[slot] = _Leaf.objects[_Slot];
+                _Distances[slot] = distance;
+
+                if (found == _K)
+                    limit = std::min(limit, _Distances[found - 1]);
+            });
+
+            if (node.has_children()) {
+                for (size_t i = 0; i < kChildren; i++)
+                    push(node.children + static_cast<node_index>(i));
+            }
+        }
+
+        for (size_t i = 0; i < found; i++)
+            _Distances[i] = std::sqrt(_Distances[i]);
+
+        return found;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::query_batch(node_index _Node, const QuadTreeAABB<T>* _Queries,
+        std::vector<uint32_t>& _Active, size_t _Begin, size_t _End, _Visitor& _Visit) const
+    {
+        const Node& node = nodes[_Node];
+
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+        NC_QUADTREE_COUNT(intersection_tests, _End - _Begin);
+
+        // queries still overlapping this node are appended behind the
+        // parent's range, which is restored once the node is done
+        for (size_t i = _Begin; i < _End; i++) {
+            if (node.max_bounds.intersects(_Queries[_Active[i]]))
+                _Active.push_back(_Active[i]);
+        }
+
+        const size_t begin = _End;
+        const size_t end = _Active.size();
+        bool running = true;
+
+        if (begin != end) {
+            if (node.has_children()) {
+                for (size_t i = 0; i < kChildren && running; i++)
+                    running = query_batch(node.children + i, _Queries, _Active, begin, end, _Visit);
+            }
+
+            for (size_t i = begin; i < end && running && node.object_count > 0; i++) {
+                const size_t query = _Active[i];
+
+                running = scan_node(_Node, _Queries[query], [&](const Leaf& _Leaf, size_t _Slot) {
+                    return visit_slot(_Visit, _Leaf, _Slot, query);
+                });
+            }
+        }
+
+        _Active.resize(begin);
+        return running;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::query_batch(const QuadTreeAABB<T>* _Queries, size_t _Count,
+        _Visitor&& _Visit, size_t _Threads) const
+    {
+        std::vector<std::pair<uint64_t, uint32_t>> order(_Count);
+        for (size_t i = 0; i < _Count; i++)
+            order[i] = { morton_key(_Queries[i]), static_cast<uint32_t>(i) };
+        std::sort(order.begin(), order.end());
+
+        if (_Threads == 0)
+            _Threads = detail::default_threads();
+
+        const size_t chunks = std::min(_Count, _Threads * kTasksPerThread);
+        std::atomic<bool> running(true);
+
+        auto run_chunk = [&](size_t _Chunk) {
+            std::vector<uint32_t> active;
+            for (size_t i = _Chunk * _Count / chunks; i < (_Chunk + 1) * _Count / chunks; i++)
+                active.push_back(order[i].second);
+
+            auto stoppable = [&](size_t _Query, const hit_type<_Visitor, size_t>& _Hit) {
+                return running.load(std::memory_order_relaxed) && detail::visit(_Visit, _Query, _Hit);
+            };
+
+            if (!query_batch(kRootNode, _Queries, active, 0, active.size(), stoppable))
+                running = false;
+        };
+
+        if (_Threads < 2 || chunks < 2) {
+            for (size_t i = 0; i < chunks; i++)
+                run_chunk(i);
+        }
+        else {
+            detail::parallel_for(chunks, _Threads, run_chunk);
+        }
+
+        return running;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::query_parallel(const QuadTreeAABB<T>& _Bounds, _Visitor&& _Visit,
+        size_t _Threads) const
+    {
+        if (_Threads == 0)
+            _Threads = detail::default_threads();
+
+        if (_Threads < 2)
+            return query(kRootNode, _Bounds, _Visit, true);
+
+        std::atomic<bool> running(true);
+
+        auto stoppable = [&](const hit_type<_Visitor>& _Hit) {
+            return running.load(std::memory_order_relaxed) && detail::visit(_Visit, _Hit);
+        };
+
+        // expand the overlapping nodes breadth first until there are enough
+        // subtrees to keep every thread busy, objects of the expanded nodes
+        // are visited on the calling thread
+        std::vector<node_index> frontier;
+        if (nodes[kRootNode].max_bounds.intersects(_Bounds))
+            frontier.push_back(kRootNode);
+
+        std::vector<node_index> expanded;
+        for (size_t next = 0; next < frontier.size()
+            && frontier.size() - next < _Threads * kTasksPerThread; next++) {
+            const Node& node = nodes[frontier[next]];
+
+            if (!node.has_children())
+                continue;
+
+            expanded.push_back(frontier[next]);
+            frontier[next] = kInvalidNode;
+
+            for (size_t i = 0; i < kChildren; i++) {
+                if (nodes[node.children + i].max_bounds.intersects(_Bounds))
+                    frontier.push_back(node.children + i);
+            }
+        }
+
+        frontier.erase(std::remove(frontier.begin(), frontier.end(), kInvalidNode), frontier.end());
+
+        for (node_index expanded_node : expanded) {
+            if (!scan_node(expanded_node, _Bounds, [&](const Leaf& _Leaf, size_t _Slot) {
+                return visit_slot(stoppable, _Leaf, _Slot);
+            })) {
+                running = false;
+                return false;
+            }
+        }
+
+        detail::parallel_for(frontier.size(), _Threads, [&](size_t _Task) {
+            if (running && !query(frontier[_Task], _Bounds, stoppable, true))
+                running = false;
+        });
+
+        return running;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::resize_nodes(size_t _Count)
+    {
+        nodes.resize(_Count);
+        node_subscribers.resize(_Count, kInvalidNode);
+        node_dirty.resize(_Count, false);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline typename QuadTree<T, _Capacity, P, _Policy, _Allocator>::node_index QuadTree<T, _Capacity, P, _Policy, _Allocator>::allocate_block()
+    {
+
+        if (!free_blocks.empty()) {
+            node_index block = free_blocks.back();
+            free_blocks.pop_back();
+            return block;
+        }
+
+        if (nodes.size() + kChildren > kInvalidNode)
+            throw std::length_error("node pool exhausted");
+
+        node_index block = static_cast<node_index>(nodes.size());
+        resize_nodes(nodes.size() + kChildren);
+        return block;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline typename QuadTree<T, _Capacity, P, _Policy, _Allocator>::node_index
+        QuadTree<T, _Capacity, P, _Policy, _Allocator>::allocate_leaf(node_index _Node)
+    {
+        node_index leaf;
+
+        if (!free_leaves.empty()) {
+            leaf = free_leaves.back();
+            free_leaves.pop_back();
+        }
+        else {
+            if (leaves.size() >= kInvalidNode)
+                throw std::length_error("leaf pool exhausted");
+
+            leaf = static_cast<node_index>(leaves.size());
+            leaves.emplace_back();
+        }
+
+        leaves[leaf].owner = _Node;
+        leaves[leaf].next = kInvalidNode;
+        return leaf;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::acquire_leaf(node_index _Node)
+    {
+        if (nodes[_Node].leaf == kInvalidNode)
+            nodes[_Node].leaf = allocate_leaf(_Node);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::release_leaf(node_index _Node)
+    {
+        node_index leaf = nodes[_Node].leaf;
+
+        while (leaf != kInvalidNode) {
+            Leaf& block = leaves[leaf];
+
+            // reused leaves must start out empty
+            for (size_t i = 0; i < _Capacity; i++) {
+                if (block.objects[i])
+                    block.clear_object(i);
+            }
+
+            free_leaves.push_back(leaf);
+            leaf = block.next;
+            block.owner = kInvalidNode;
+            block.next = kInvalidNode;
+        }
+
+        nodes[_Node].leaf = kInvalidNode;
+        nodes[_Node].object_count = 0;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::place_object(node_index _Node,
+        const object_ptr& _Object)
+    {
+        acquire_leaf(_Node);
+
+        node_index leaf = nodes[_Node].leaf;
+        size_t slot = 0;
+        while (slot < _Capacity && leaves[leaf].objects[slot])
+            slot++;
+
+        if (slot == _Capacity) {
+            // may grow the pool, so leaves are only referenced after allocation
+            const node_index head = allocate_leaf(_Node);
+            leaves[head].next = leaf;
+            nodes[_Node].leaf = leaf = head;
+            slot = 0;
+        }
+
+        store_object(leaf, slot, _Object);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::store_object(node_index _Leaf, size_t _Slot,
+        const object_ptr& _Object)
+    {
+        Leaf& leaf = leaves[_Leaf];
+
+        leaf.set_object(_Slot, _Object);
+        nodes[leaf.owner].object_count++;
+        locations[_Object->id] = Location{ _Leaf, static_cast<uint32_t>(_Slot) };
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::erase_object(node_index _Leaf, size_t _Slot)
+    {
+        const node_index node = leaves[_Leaf].owner;
+
+        locations.erase(leaves[_Leaf].objects[_Slot]->id);
+        leaves[_Leaf].clear_object(_Slot);
+
+        if (--nodes[node].object_count == 0) {
+            release_leaf(node);
+            return;
+        }
+
+        const node_index head = nodes[node].leaf;
+        if (_Leaf != head) {
+            Leaf& first = leaves[head];
+            size_t slot = 0;
+            while (!first.objects[slot])
+                slot++;
+
+            const object_ptr object = first.objects[slot];
+            first.clear_object(slot);
+            leaves[_Leaf].set_object(_Slot, object);
+            locations[object->id] = Location{ _Leaf, static_cast<uint32_t>(_Slot) };
+        }
+
+        Leaf& first = leaves[head];
+        if (first.next == kInvalidNode)
+            return;
+
+        for (size_t i = 0; i < _Capacity; i++) {
+            if (first.objects[i])
+                return;
+        }
+
+        nodes[node].leaf = first.next;
+        first.owner = kInvalidNode;
+        first.next = kInvalidNode;
+        free_leaves.push_back(head);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::push_down(node_index _Node)
+    {
+        // the children are empty and each has room for all of the objects,
+        // nodes that split never chain blocks
+        if (nodes[_Node].object_count == 0)
+            return;
+
+        const node_index leaf = nodes[_Node].leaf;
+
+        for (size_t i = 0; i < _Capacity; i++) {
+            if (!leaves[leaf].objects[i])
+                continue;
+
+            const object_ptr object = leaves[leaf].objects[i];
+            const node_index child = child_for(_Node, object->bounds);
+
+            place_object(child, object);
+            nodes[child].total_count++;
+            grow_max_bounds(child, QuadTreeBox<T>(object->bounds));
+        }
+
+        // the total of _Node does not change
+        release_leaf(_Node);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::adjust_total(node_index _Node, ptrdiff_t _Delta)
+    {
+        for (; _Node != kInvalidNode; _Node = nodes[_Node].root)
+            nodes[_Node].total_count = static_cast<uint32_t>(nodes[_Node].total_count + _Delta);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::subdivides(node_index _Node) const
+    {
+        const Node& node = nodes[_Node];
+        const QuadTreeBox<T>& bounds = node.bounds;
+        const T x = bounds.center_x();
+        const T y = bounds.center_y();
+
+        // the root is at level 1
+        if (node.level > kMaxDepth)
+            return false;
+
+        if constexpr (kMinSize > 0.0) {
+            if (((double)bounds.right - (double)bounds.left) / 2.0 < kMinSize
+                || ((double)bounds.bottom - (double)bounds.top) / 2.0 < kMinSize)
+                return false;
+        }
+
+        // integer and exhausted floating point coordinates end up with
+        // centers on the boundaries, the children would be empty
+        return bounds.left < x && x < bounds.right
+            && bounds.top < y && y < bounds.bottom;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::split(node_index _Node)
+    {
+        if (!nodes[_Node].has_children()) {
+            NC_QUADTREE_COUNT(splits, 1);
+
+            // may grow the pool, so nodes are only referenced after allocation
+            node_index block = allocate_block();
+
+            const QuadTreeBox<T> bounds = nodes[_Node].bounds;
+            const T x = bounds.center_x();
+            const T y = bounds.center_y();
+            const uint32_t level = nodes[_Node].level;
+
+            const QuadTreeBox<T> child_box[kChildren] = {
+                // top left
+                QuadTreeBox<T>(bounds.left, bounds.top, x, y),
+                // top right
+                QuadTreeBox<T>(x, bounds.top, bounds.right, y),
+                // bottom right
+                QuadTreeBox<T>(x, y, bounds.right, bounds.bottom),
+                // bottom left
+                QuadTreeBox<T>(bounds.left, y, x, bounds.bottom)
+            };
+
+            for (size_t i = 0; i < kChildren; i++) {
+                Node& child = nodes[block + i];
+
+                child.bounds = child_box[i];
+                child.max_bounds = child_box[i];
+                child.children = kInvalidNode;
+                child.root = _Node;
+                child.level = level + 1;
+                child.object_count = 0;
+                child.total_count = 0;
+                node_dirty[block + i] = false;
+            }
+
+            nodes[_Node].children = block;
+
+            if (node_subscribers[_Node] != kInvalidNode)
+                push_down_subscriptions(_Node);
+
+            // loose trees keep objects at the level their size calls for
+            if (!is_loose())
+                push_down(_Node);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::merge(node_index _Node)
+    {
+        // pulls every object of the subtree into _Node, callers make sure
+        // the subtree holds no more than _Capacity objects
+        if (nodes[_Node].has_children()) {
+            NC_QUADTREE_COUNT(merges, 1);
+
+            node_index block = nodes[_Node].children;
+
+            for (size_t i = 0; i < kChildren; i++) {
+                merge(block + i);
+
+                const node_index child = block + static_cast<node_index>(i);
+
+                // place_object() may grow the leaf pool
+                std::vector<object_ptr> objects;
+                objects.reserve(nodes[child].object_count);
+                visit_objects(child, [&](const object_ptr& _Object) { objects.push_back(_Object); });
+                release_leaf(child);
+
+                for (const object_ptr& object : objects)
+                    place_object(_Node, object);
+
+                nodes[child].total_count = 0;
+
+                if (node_subscribers[child] != kInvalidNode)
+                    move_subscribers(child, _Node);
+            }
+
+            free_blocks.push_back(block);
+            nodes[_Node].children = kInvalidNode;
+            mark_dirty(_Node);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::attach_subscription(uint32_t _Id)
+    {
+        const QuadTreeBox<T>& region = subscriptions[_Id].region;
+        node_index node = kRootNode;
+
+        // children of a split node cover it, at most one can contain the region
+        while (nodes[node].has_children()) {
+            node_index next = kInvalidNode;
+
+            for (size_t i = 0; i < kChildren; i++) {
+                const node_index child = nodes[node].children + static_cast<node_index>(i);
+
+                if (QuadTreeBox<T>(nodes[child].bounds).contains(region)) {
+                    next = child;
+                    break;
+                }
+            }
+
+            if (next == kInvalidNode)
+                break;
+            node = next;
+        }
+
+        if (node_subscribers[node] == kInvalidNode) {
+            if (!free_subscriber_lists.empty()) {
+                node_subscribers[node] = free_subscriber_lists.back();
+                free_subscriber_lists.pop_back();
+            }
+            else {
+                node_subscribers[node] = static_cast<node_index>(subscriber_lists.size());
+                // moved in so polymorphic allocators are not passed twice
+                subscriber_lists.push_back(pool<uint32_t>(subscriber_lists.get_allocator()));
+            }
+        }
+
+        subscriber_lists[node_subscribers[node]].push_back(_Id);
+        subscriptions[_Id].node = node;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::detach_subscription(uint32_t _Id)
+    {
+        const node_index node = subscriptions[_Id].node;
+        pool<uint32_t>& list = subscriber_lists[node_subscribers[node]];
+
+        list.erase(std::find(list.begin(), list.end(), _Id));
+
+        if (list.empty()) {
+            free_subscriber_lists.push_back(node_subscribers[node]);
+            node_subscribers[node] = kInvalidNode;
+        }
+
+        subscriptions[_Id].node = kInvalidNode;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::move_subscribers(node_index _From, node_index _To)
+    {
+        const node_index from = node_subscribers[_From];
+        node_subscribers[_From] = kInvalidNode;
+
+        for (uint32_t id : subscriber_lists[from])
+            subscriptions[id].node = _To;
+
+        if (node_subscribers[_To] == kInvalidNode) {
+            node_subscribers[_To] = from;
+            return;
+        }
+
+        pool<uint32_t>& to = subscriber_lists[node_subscribers[_To]];
+        to.insert(to.end(), subscriber_lists[from].begin(), subscriber_lists[from].end());
+
+        subscriber_lists[from].clear();
+        free_subscriber_lists.push_back(from);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::push_down_subscriptions(node_index _Node)
+    {
+        const pool<uint32_t> list = std::move(subscriber_lists[node_subscribers[_Node]]);
+        subscriber_lists[node_subscribers[_Node]].clear();
+
+        free_subscriber_lists.push_back(node_subscribers[_Node]);
+        node_subscribers[_Node] = kInvalidNode;
+
+        // the children are new leaves, so attaching stops right below _Node
+        for (uint32_t id : list)
+            attach_subscription(id);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::rehome_subscriptions()
+    {
+        subscriber_lists.clear();
+        free_subscriber_lists.clear();
+
+        for (size_t i = 0; i < nodes.size(); i++)
+            node_subscribers[i] = kInvalidNode;
+
+        for (size_t i = 0; i < subscriptions.size(); i++) {
+            if (subscriptions[i].node != kInvalidNode)
+                attach_subscription(static_cast<uint32_t>(i));
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Func>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::for_subscriptions(node_index _Node,
+        const QuadTreeBox<T>& _Bounds, _Func& _Fn) const
+    {
+        const Node& node = nodes[_Node];
+
+        if (node_subscribers[_Node] != kInvalidNode) {
+            for (uint32_t id : subscriber_lists[node_subscribers[_Node]]) {
+                if (subscriptions[id].region.intersects(_Bounds))
+                    _Fn(subscriptions[id]);
+            }
+        }
+
+        // a region inside a child intersects the box only if the child does
+        if (!node.has_children())
+            return;
+
+        for (size_t i = 0; i < kChildren; i++) {
+            const node_index child = node.children + static_cast<node_index>(i);
+
+            if (_Bounds.intersects(nodes[child].bounds))
+                for_subscriptions(child, _Bounds, _Fn);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::notify(const object_ptr& _Object,
+        const QuadTreeBox<T>* _Old, const QuadTreeBox<T>* _New) const
+    {
+        if (_Old) {
+            auto leave = [&](const Subscription& _Subscription) {
+                if (!_New || !_Subscription.region.intersects(*_New))
+                    _Subscription.callback(_Object, QuadTreeEvent::leave);
+            };
+            for_subscriptions(kRootNode, *_Old, leave);
+        }
+
+        if (_New) {
+            auto enter = [&](const Subscription& _Subscription) {
+                if (!_Old || !_Subscription.region.intersects(*_Old))
+                    _Subscription.callback(_Object, QuadTreeEvent::enter);
+            };
+            for_subscriptions(kRootNode, *_New, enter);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::notify_all(QuadTreeEvent _Event) const
+    {
+        for (const Subscription& subscription : subscriptions) {
+            if (subscription.node == kInvalidNode)
+                continue;
+
+            auto report = [&](const object_ptr& _Object) {
+                subscription.callback(_Object, _Event);
+            };
+            query(kRootNode, subscription.region.to_aabb(), report, true);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::subscribe(const QuadTreeAABB<T>& _Region,
+        subscription_callback _Callback)
+    {
+        uint32_t id;
+        if (!free_subscriptions.empty()) {
+            id = free_subscriptions.back();
+            free_subscriptions.pop_back();
+        }
+        else {
+            id = static_cast<uint32_t>(subscriptions.size());
+            subscriptions.emplace_back();
+        }
+
+        Subscription& subscription = subscriptions[id];
+        subscription.region = QuadTreeBox<T>(_Region);
+        subscription.callback = std::move(_Callback);
+
+        attach_subscription(id);
+        active_subscriptions++;
+
+        auto report = [&](const object_ptr& _Object) {
+            subscriptions[id].callback(_Object, QuadTreeEvent::enter);
+        };
+        query(kRootNode, _Region, report, true);
+
+        return id;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::move_subscription(size_t _Id, const QuadTreeAABB<T>& _Region)
+    {
+        if (_Id >= subscriptions.size() || subscriptions[_Id].node == kInvalidNode)
+            return false;
+
+        const uint32_t id = static_cast<uint32_t>(_Id);
+        const QuadTreeBox<T> old_region = subscriptions[id].region;
+        const QuadTreeBox<T> new_region(_Region);
+
+        detach_subscription(id);
+        subscriptions[id].region = new_region;
+        attach_subscription(id);
+
+        const subscription_callback& callback = subscriptions[id].callback;
+
+        auto leave = [&](const object_ptr& _Object) {
+            if (!new_region.intersects(_Object->bounds))
+                callback(_Object, QuadTreeEvent::leave);
+        };
+        query(kRootNode, old_region.to_aabb(), leave, true);
+
+        auto enter = [&](const object_ptr& _Object) {
+            if (!old_region.intersects(_Object->bounds))
+                callback(_Object, QuadTreeEvent::enter);
+        };
+        query(kRootNode, _Region, enter, true);
+
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::unsubscribe(size_t _Id)
+    {
+        if (_Id >= subscriptions.size() || subscriptions[_Id].node == kInvalidNode)
+            return false;
+
+        detach_subscription(static_cast<uint32_t>(_Id));
+        subscriptions[_Id].callback = nullptr;
+
+        free_subscriptions.push_back(static_cast<uint32_t>(_Id));
+        active_subscriptions--;
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::merge_underfull(node_index _Node)
+    {
+        // subtree counts only grow towards the root, so the walk stops at the
+        // first ancestor above the threshold and merges the last one below it
+        node_index target = kInvalidNode;
+
+        for (; _Node != kInvalidNode && nodes[_Node].total_count <= kMergeThreshold;
+            _Node = nodes[_Node].root) {
+            if (nodes[_Node].has_children())
+                target = _Node;
+        }
+
+        if (target != kInvalidNode)
+            merge(target);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::grow_max_bounds(node_index _Node, const QuadTreeBox<T>& _Bounds)
+    {
+        // ancestors always cover their descendants, so the walk can stop at
+        // the first node that already covers the new box
+        while (_Node != kInvalidNode && !nodes[_Node].max_bounds.contains(_Bounds)) {
+            nodes[_Node].max_bounds.expand(_Bounds);
+            _Node = nodes[_Node].root;
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::mark_dirty(node_index _Node)
+    {
+        while (_Node != kInvalidNode && !node_dirty[_Node]) {
+            node_dirty[_Node] = true;
+            _Node = nodes[_Node].root;
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::refit(node_index _Node, bool _All)
+    {
+        if (!_All && !node_dirty[_Node])
+            return;
+
+        if (nodes[_Node].has_children()) {
+            node_index block = nodes[_Node].children;
+
+            for (size_t i = 0; i < kChildren; i++)
+                refit(block + i, _All);
+        }
+
+        fit_max_bounds(_Node);
+        node_dirty[_Node] = false;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::fit_max_bounds(node_index _Node)
+    {
+        Node& node = nodes[_Node];
+        QuadTreeBox<T>& max_bounds = node.max_bounds;
+
+        max_bounds = node.bounds;
+
+        for_objects(_Node, [&](const Leaf& _Leaf, size_t _Slot) {
+            max_bounds.expand(_Leaf.object_bounds(_Slot));
+
+            if (!max_bounds.verify()) {
+                throw std::invalid_argument("invalid bounds");
+            }
+        });
+
+        if (node.has_children()) {
+            for (size_t i = 0; i < kChildren; i++) {
+                max_bounds.expand(nodes[node.children + i].max_bounds);
+
+                if (!max_bounds.verify()) {
+                    throw std::invalid_argument("invalid bounds");
+                }
+            }
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::compact(std::chrono::steady_clock::duration _Budget)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<uint8_t>& path = compaction.path;
+        if (!compaction.active) {
+            path.clear();
+            compaction.ascending = false;
+            compaction.active = true;
+        }
+
+        // follows the path again, nodes merged since the last step cut it short
+        node_index node = kRootNode;
+        for (size_t depth = 0; depth < path.size(); depth++) {
+            if (!nodes[node].has_children()) {
+                path.resize(depth);
+                compaction.ascending = false;
+                break;
+            }
+
+            node = nodes[node].children + path[depth];
+        }
+
+        size_t steps = 0;
+
+        for (;;) {
+            // at least one stride per call, so every step makes progress
+            if (++steps % kCompactionStride == 0 && std::chrono::steady_clock::now() - start >= _Budget)
+                return false;
+
+            // subtrees small enough to merge are not walked, merge() collects them
+            if (!compaction.ascending && nodes[node].has_children()
+                && nodes[node].total_count > kMergeThreshold) {
+                path.push_back(0);
+                node = nodes[node].children;
+                continue;
+            }
+
+            if (nodes[node].has_children() && nodes[node].total_count <= kMergeThreshold)
+                merge(node);
+
+            // children changed after the walk finished them are dirty again,
+            // they are refit first so no dirty node ends up below a clean one
+            if (nodes[node].has_children()) {
+                for (size_t i = 0; i < kChildren; i++)
+                    refit(nodes[node].children + static_cast<node_index>(i), false);
+            }
+
+            // children are done, so this is the one bottom-up refit of the node
+            fit_max_bounds(node);
+            node_dirty[node] = false;
+
+            if (path.empty())
+                break;
+
+            const node_index parent = nodes[node].root;
+
+            if (++path.back() < kChildren) {
+                node = nodes[parent].children + path.back();
+                compaction.ascending = false;
+            }
+            else {
+                path.pop_back();
+                node = parent;
+                compaction.ascending = true;
+            }
+        }
+
+        if (steps >= kCompactionStride && std::chrono::steady_clock::now() - start >= _Budget) {
+            // the next step refits the root once more and relocates
+            compaction.ascending = true;
+            return false;
+        }
+
+        relocate();
+        compaction.active = false;
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::relocate()
+    {
+        pool<Node> moved(nodes.get_allocator());
+        moved.reserve(nodes.size() - free_blocks.size() * kChildren);
+
+        pool<Leaf> packed(leaves.get_allocator());
+        packed.reserve(leaves.size() - free_leaves.size());
+
+        std::vector<node_index> remap(nodes.size(), kInvalidNode);
+        remap[kRootNode] = kRootNode;
+        moved.push_back(nodes[kRootNode]);
+
+        // old indices in preorder, a node's block is placed when it is popped
+        std::vector<node_index> stack{ kRootNode };
+
+        while (!stack.empty()) {
+            const node_index old = stack.back();
+            const node_index target = remap[old];
+            stack.pop_back();
+
+            // the blocks of a chain end up next to each other
+            if (nodes[old].leaf != kInvalidNode)
+                moved[target].leaf = static_cast<node_index>(packed.size());
+
+            for (node_index old_leaf = nodes[old].leaf; old_leaf != kInvalidNode; old_leaf = leaves[old_leaf].next) {
+                const node_index leaf = static_cast<node_index>(packed.size());
+                packed.push_back(std::move(leaves[old_leaf]));
+                packed[leaf].owner = target;
+                if (packed[leaf].next != kInvalidNode)
+                    packed[leaf].next = leaf + 1;
+
+                for (size_t i = 0; i < _Capacity; i++) {
+                    if (packed[leaf].objects[i])
+                        locations[packed[leaf].objects[i]->id].leaf = leaf;
+                }
+            }
+
+            if (!nodes[old].has_children())
+                continue;
+
+            const node_index block = static_cast<node_index>(moved.size());
+            moved[target].children = block;
+
+            for (size_t i = 0; i < kChildren; i++) {
+                const node_index child = nodes[old].children + static_cast<node_index>(i);
+
+                remap[child] = block + static_cast<node_index>(i);
+                moved.push_back(nodes[child]);
+                moved.back().root = target;
+            }
+
+            // reversed so the first child's subtree follows the block
+            for (size_t i = kChildren; i > 0; i--)
+                stack.push_back(nodes[old].children + static_cast<node_index>(i - 1));
+        }
+
+        for (Subscription& subscription : subscriptions) {
+            if (subscription.node != kInvalidNode)
+                subscription.node = remap[subscription.node];
+        }
+
+        pool<node_index> moved_subscribers(moved.size(), kInvalidNode, node_subscribers.get_allocator());
+        pool<uint8_t> moved_dirty(moved.size(), false, node_dirty.get_allocator());
+
+        for (size_t i = 0; i < remap.size(); i++) {
+            if (remap[i] == kInvalidNode)
+                continue;
+
+            moved_subscribers[remap[i]] = node_subscribers[i];
+            moved_dirty[remap[i]] = node_dirty[i];
+        }
+
+        nodes.swap(moved);
+        node_subscribers.swap(moved_subscribers);
+        node_dirty.swap(moved_dirty);
+        leaves.swap(packed);
+        free_blocks.clear();
+        free_blocks.shrink_to_fit();
+        free_leaves.clear();
+        free_leaves.shrink_to_fit();
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline uint64_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::morton_key(const QuadTreeAABB<T>& _Bounds) const
+    {
+        const QuadTreeBox<T>& root = nodes[kRootNode].bounds;
+        const double scale = 4294967296.0;
+
+        auto quantize = [scale](double _Value, double _Min, double _Max) {
+            double cell = (_Value - _Min) / (_Max - _Min) * scale;
+            cell = std::min(std::max(cell, 0.0), scale - 1.0);
+            return static_cast<uint64_t>(cell);
+        };
+
+        // spreads the low 32 bits of _Value over the even bits
+        auto spread = [](uint64_t _Value) {
+            _Value &= 0xffffffffull;
+            _Value = (_Value | (_Value << 16)) & 0x0000ffff0000ffffull;
+            _Value = (_Value | (_Value << 8)) & 0x00ff00ff00ff00ffull;
+            _Value = (_Value | (_Value << 4)) & 0x0f0f0f0f0f0f0f0full;
+            _Value = (_Value | (_Value << 2)) & 0x3333333333333333ull;
+            _Value = (_Value | (_Value << 1)) & 0x5555555555555555ull;
+            return _Value;
+        };
+
+        uint64_t x = quantize(((double)_Bounds.left + (double)_Bounds.right) / 2.0,
+            (double)root.left, (double)root.right);
+        uint64_t y = quantize(((double)_Bounds.top + (double)_Bounds.bottom) / 2.0,
+            (double)root.top, (double)root.bottom);
+
+        return spread(x) | (spread(y) << 1);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::sort_entries(std::vector<BuildEntry>& _Entries) const
+    {
+        auto by_key = [](const BuildEntry& _A, const BuildEntry& _B) { return _A.key < _B.key; };
+
+        size_t threads = std::thread::hardware_concurrency();
+        if (_Entries.size() < kParallelBuildThreshold || threads < 2) {
+            std::sort(_Entries.begin(), _Entries.end(), by_key);
+            return;
+        }
+
+        // the top two key bits select the root quadrant, so bucketing by them
+        // leaves four ranges that can be sorted independently
+        size_t offsets[kChildren + 1] = {};
+        for (const BuildEntry& entry : _Entries)
+            offsets[(entry.key >> 62) + 1]++;
+        for (size_t i = 0; i < kChildren; i++)
+            offsets[i + 1] += offsets[i];
+
+        std::vector<BuildEntry> buckets(_Entries.size());
+        size_t cursor[kChildren] = { offsets[0], offsets[1], offsets[2], offsets[3] };
+        for (BuildEntry& entry : _Entries)
+            buckets[cursor[entry.key >> 62]++] = std::move(entry);
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < kChildren; i++) {
+            workers.emplace_back([&buckets, &offsets, by_key, i]() {
+                std::sort(buckets.begin() + offsets[i], buckets.begin() + offsets[i + 1], by_key);
+            });
+        }
+        std::sort(buckets.begin() + offsets[0], buckets.begin() + offsets[1], by_key);
+
+        for (std::thread& worker : workers)
+            worker.join();
+
+        _Entries.swap(buckets);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::build(node_index _Node, BuildEntry* _First, BuildEntry* _Last,
+        size_t _Depth, std::vector<object_ptr>& _Rejected)
+    {
+        // morton quadrant digit to child slot, children go clockwise from top left
+        static constexpr size_t kMortonChild[kChildren] = { 0, 1, 3, 2 };
+
+        size_t count = static_cast<size_t>(_Last - _First);
+
+        if (count <= kSplitThreshold || _Depth >= kMortonDepth || !subdivides(_Node)) {
+            // nodes that cannot split chain blocks for everything
+            size_t stored = subdivides(_Node) ? std::min(count, kSplitThreshold) : count;
+
+            for (size_t i = 0; i < stored; i++)
+                place_object(_Node, _First[i].object);
+
+            // identical keys that do not fit are inserted afterwards
+            for (size_t i = stored; i < count; i++)
+                _Rejected.push_back(_First[i].object);
+
+            nodes[_Node].total_count = static_cast<uint32_t>(stored);
+            fit_max_bounds(_Node);
+            return;
+        }
+
+        split(_Node);
+
+        const node_index block = nodes[_Node].children;
+        const size_t shift = 62 - 2 * _Depth;
+
+        BuildEntry* begin = _First;
+        for (size_t digit = 0; digit < kChildren; digit++) {
+            BuildEntry* end = std::partition_point(begin, _Last, [&](const BuildEntry& _Entry) {
+                return ((_Entry.key >> shift) & 3) <= digit;
+            });
+
+            const node_index child = block + static_cast<node_index>(kMortonChild[digit]);
+            const QuadTreeBox<T> child_bounds = nodes[child].bounds;
+
+            // rounding of the key may disagree with split() right at the
+            // center lines, such objects go through insert() afterwards
+            BuildEntry* kept = std::remove_if(begin, end, [&](const BuildEntry& _Entry) {
+                if (child_bounds.intersects(_Entry.object->bounds))
+                    return false;
+
+                _Rejected.push_back(_Entry.object);
+                return true;
+            });
+
+            build(child, begin, kept, _Depth + 1, _Rejected);
+            begin = end;
+        }
+
+        nodes[_Node].total_count = 0;
+        for (size_t i = 0; i < kChildren; i++)
+            nodes[_Node].total_count += nodes[block + i].total_count;
+
+        fit_max_bounds(_Node);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Iterator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::build(_Iterator _First, _Iterator _Last)
+    {
+        const QuadTreeBox<T> bounds = nodes[kRootNode].bounds;
+
+        if (active_subscriptions > 0)
+            notify_all(QuadTreeEvent::leave);
+
+        nodes.clear();
+        node_subscribers.clear();
+        node_dirty.clear();
+        resize_nodes(1);
+        free_blocks.clear();
+        leaves.clear();
+        free_leaves.clear();
+        locations.clear();
+        subscriber_lists.clear();
+        free_subscriber_lists.clear();
+        set_bounds(bounds.to_aabb());
+
+        std::vector<BuildEntry> entries;
+        for (; _First != _Last; ++_First) {
+            const object_ptr& object = *_First;
+
+            if (bounds.intersects(object->bounds))
+                entries.push_back({ morton_key(object->bounds), object });
+        }
+
+        // ids must stay unique, later duplicates are dropped like in insert()
+        {
+            std::unordered_map<size_t, bool> seen;
+            seen.reserve(entries.size());
+
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const BuildEntry& _Entry) {
+                return !seen.emplace(_Entry.object->id, true).second;
+            }), entries.end());
+        }
+
+        if (entries.size() > kMaxObjects)
+            throw std::length_error("object count exhausted");
+
+        locations.reserve(entries.size());
+
+        sort_entries(entries);
+
+        // loose placement depends on object size, the sorted order still
+        // gives inserts good locality
+        if (is_loose()) {
+            for (const BuildEntry& entry : entries)
+                insert(kRootNode, entry.object);
+        }
+        else {
+            std::vector<object_ptr> rejected;
+            build(kRootNode, entries.data(), entries.data() + entries.size(), 0, rejected);
+
+            for (const object_ptr& object : rejected)
+                insert(kRootNode, object);
+        }
+
+        if (active_subscriptions > 0) {
+            rehome_subscriptions();
+            notify_all(QuadTreeEvent::enter);
+        }
+
+        return entries.size();
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::distribute(node_index _Node,
+        std::vector<object_ptr>& _Objects, size_t _Depth, size_t _TaskDepth,
+        std::vector<InsertTask>& _Tasks)
+    {
+        // leaves are only split up front while the objects would overflow
+        // them, existing subtrees are left to the workers
+        if (_Depth >= _TaskDepth || (!nodes[_Node].has_children() && (!subdivides(_Node)
+            || nodes[_Node].object_count + _Objects.size() <= kSplitThreshold))) {
+            _Tasks.push_back(InsertTask{ _Node, std::move(_Objects), {}, {} });
+            return;
+        }
+
+        split(_Node);
+
+        const node_index block = nodes[_Node].children;
+        std::vector<object_ptr> routed[kChildren];
+
+        for (object_ptr& object : _Objects)
+            routed[child_for(_Node, object->bounds) - block].push_back(std::move(object));
+
+        for (size_t i = 0; i < kChildren; i++) {
+            if (!routed[i].empty())
+                distribute(block + static_cast<node_index>(i), routed[i], _Depth + 1, _TaskDepth, _Tasks);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::fill_task(InsertTask& _Task, QuadTree& _Scratch) const
+    {
+        std::vector<std::pair<node_index, std::vector<object_ptr>>> groups;
+        std::unordered_map<node_index, size_t> group_of;
+
+        for (object_ptr& object : _Task.objects) {
+            node_index node = _Task.node;
+            while (nodes[node].has_children())
+                node = child_for(node, object->bounds);
+
+            auto it = group_of.emplace(node, groups.size());
+            if (it.second)
+                groups.emplace_back(node, std::vector<object_ptr>());
+
+            groups[it.first->second].second.push_back(std::move(object));
+        }
+
+        for (auto& group : groups) {
+            const node_index leaf = group.first;
+
+            if (nodes[leaf].object_count + group.second.size() <= kSplitThreshold || !subdivides(leaf)) {
+                _Task.direct.push_back(std::move(group));
+                continue;
+            }
+
+            // a private root standing in for the leaf, the leaf's own objects
+            // go in first and are stored again when it is spliced
+            Node root;
+            root.bounds = nodes[leaf].bounds;
+            root.max_bounds = nodes[leaf].bounds;
+            root.level = nodes[leaf].level;
+
+            const node_index index = static_cast<node_index>(_Scratch.nodes.size());
+            _Scratch.resize_nodes(index + 1);
+            _Scratch.nodes[index] = root;
+
+            visit_objects(leaf, [&](const object_ptr& _Object) { _Scratch.insert(index, _Object); });
+
+            for (const object_ptr& object : group.second)
+                _Scratch.insert(index, object);
+
+            _Task.rebuilt.emplace_back(index, leaf);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline void QuadTree<T, _Capacity, P, _Policy, _Allocator>::splice(QuadTree& _From,
+        const std::vector<std::pair<node_index, node_index>>& _Roots)
+    {
+        // the private tree only grew, so it has no free blocks. its other
+        // nodes keep their pool order, which keeps sibling blocks contiguous
+        std::vector<node_index> remap(_From.nodes.size(), kInvalidNode);
+        for (const auto& root : _Roots)
+            remap[root.first] = root.second;
+
+        size_t next = nodes.size();
+        for (size_t i = 1; i < _From.nodes.size(); i++) {
+            if (remap[i] == kInvalidNode)
+                remap[i] = static_cast<node_index>(next++);
+        }
+
+        if (next > kInvalidNode)
+            throw std::length_error("node pool exhausted");
+        if (leaves.size() + _From.leaves.size() >= kInvalidNode)
+            throw std::length_error("leaf pool exhausted");
+
+        const node_index leaf_offset = static_cast<node_index>(leaves.size());
+        auto moved_leaf = [&](node_index _Leaf) {
+            return _Leaf == kInvalidNode ? kInvalidNode : _Leaf + leaf_offset;
+        };
+
+        resize_nodes(next);
+
+        // roots, and the unused root of the private tree itself, have no parent
+        for (size_t i = 1; i < _From.nodes.size(); i++) {
+            const Node& from = _From.nodes[i];
+            if (from.root == kInvalidNode)
+                continue;
+
+            Node& node = nodes[remap[i]];
+            node = from;
+            node.root = remap[from.root];
+            node.children = from.has_children() ? remap[from.children] : kInvalidNode;
+            node.leaf = moved_leaf(from.leaf);
+        }
+
+        for (const auto& root : _Roots) {
+            const Node& from = _From.nodes[root.first];
+            const node_index target = root.second;
+            const ptrdiff_t delta = static_cast<ptrdiff_t>(from.total_count)
+                - static_cast<ptrdiff_t>(nodes[target].total_count);
+
+            // the objects are in the private tree as well
+            release_leaf(target);
+
+            nodes[target].children = from.has_children() ? remap[from.children] : kInvalidNode;
+            nodes[target].leaf = moved_leaf(from.leaf);
+            nodes[target].object_count = from.object_count;
+            nodes[target].max_bounds = from.max_bounds;
+
+            adjust_total(target, delta);
+            grow_max_bounds(nodes[target].root, from.max_bounds);
+        }
+
+        for (Leaf& leaf : _From.leaves) {
+            leaves.push_back(std::move(leaf));
+            Leaf& moved = leaves.back();
+            moved.owner = moved.owner == kInvalidNode ? kInvalidNode : remap[moved.owner];
+            moved.next = moved_leaf(moved.next);
+        }
+        for (node_index leaf : _From.free_leaves)
+            free_leaves.push_back(leaf + leaf_offset);
+
+        for (const auto& entry : _From.locations)
+            locations[entry.first] = Location{ entry.second.leaf + leaf_offset, entry.second.slot };
+
+        // subscriptions of the replaced leaves may fit into the new children
+        for (const auto& root : _Roots) {
+            if (node_subscribers[root.second] != kInvalidNode && nodes[root.second].has_children())
+                push_down_subscriptions(root.second);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Iterator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::insert_batch(_Iterator _First, _Iterator _Last, size_t _Threads)
+    {
+        std::vector<object_ptr> objects;
+        {
+            std::unordered_map<size_t, bool> seen;
+
+            for (; _First != _Last; ++_First) {
+                const object_ptr& object = *_First;
+
+                if (nodes[kRootNode].bounds.intersects(object->bounds) && !locations.count(object->id)
+                    && seen.emplace(object->id, true).second)
+                    objects.push_back(object);
+            }
+        }
+
+        const size_t count = objects.size();
+
+        if (locations.size() + count > kMaxObjects)
+            throw std::length_error("object count exhausted");
+
+        if (_Threads == 0)
+            _Threads = detail::default_threads();
+
+        if (_Threads < 2 || count < kParallelBuildThreshold || is_loose()) {
+            for (const object_ptr& object : objects)
+                insert(kRootNode, object);
+
+            for (size_t i = 0; i < count && active_subscriptions > 0; i++) {
+                const QuadTreeBox<T> bounds(objects[i]->bounds);
+                notify(objects[i], nullptr, &bounds);
+            }
+            return count;
+        }
+
+        // distribute() moves the objects out of the list
+        std::vector<object_ptr> notified;
+        if (active_subscriptions > 0)
+            notified = objects;
+
+        // deep enough for kTasksPerThread subtrees per thread
+        size_t task_depth = 1;
+        while (((size_t)1 << (2 * task_depth)) < _Threads * kTasksPerThread)
+            task_depth++;
+
+        std::vector<InsertTask> tasks;
+        distribute(kRootNode, objects, 0, task_depth, tasks);
+
+        // subtrees are disjoint and the workers only read the shared tree,
+        // new nodes go to a private tree per task
+        std::vector<QuadTree> scratch;
+        scratch.reserve(tasks.size());
+        for (size_t i = 0; i < tasks.size(); i++)
+            scratch.emplace_back(get_allocator());
+
+        detail::parallel_for(tasks.size(), _Threads, [&](size_t _Task) {
+            fill_task(tasks[_Task], scratch[_Task]);
+        });
+
+        for (size_t i = 0; i < tasks.size(); i++) {
+            for (const auto& group : tasks[i].direct) {
+                for (const object_ptr& object : group.second) {
+                    place_object(group.first, object);
+                    adjust_total(group.first, 1);
+                    grow_max_bounds(group.first, QuadTreeBox<T>(object->bounds));
+                }
+            }
+
+            if (!tasks[i].rebuilt.empty())
+                splice(scratch[i], tasks[i].rebuilt);
+        }
+
+        for (const object_ptr& object : notified) {
+            const QuadTreeBox<T> bounds(object->bounds);
+            notify(object, nullptr, &bounds);
+        }
+
+        return count;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::loose_depth(const QuadTreeAABB<T>& _Bounds) const
+    {
+        // a node of size s holds objects up to (looseness - 1) * s wide when
+        // their center is inside it, so the depth is a log2 of the size ratio
+        const QuadTreeBox<T>& root = nodes[kRootNode].bounds;
+        const double extent_x = (double)_Bounds.right - (double)_Bounds.left;
+        const double extent_y = (double)_Bounds.bottom - (double)_Bounds.top;
+        const double room_x = (looseness - 1.0) * ((double)root.right - (double)root.left);
+        const double room_y = (looseness - 1.0) * ((double)root.bottom - (double)root.top);
+
+        double ratio = std::numeric_limits<double>::infinity();
+        if (extent_x > 0.0)
+            ratio = std::min(ratio, room_x / extent_x);
+        if (extent_y > 0.0)
+            ratio = std::min(ratio, room_y / extent_y);
+
+        if (!(ratio >= 1.0))
+            return 0;
+        if (ratio >= std::ldexp(1.0, (int)kMaxLooseDepth))
+            return kMaxLooseDepth;
+
+        return static_cast<size_t>(std::floor(std::log2(ratio)));
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::loose_fits(node_index _Node, const QuadTreeAABB<T>& _Bounds) const
+    {
+        const QuadTreeBox<T>& bounds = nodes[_Node].bounds;
+        const double x = ((double)_Bounds.left + (double)_Bounds.right) / 2.0;
+        const double y = ((double)_Bounds.top + (double)_Bounds.bottom) / 2.0;
+
+        return x >= (double)bounds.left && x < (double)bounds.right
+            && y >= (double)bounds.top && y < (double)bounds.bottom
+            && nodes[_Node].level - 1 <= loose_depth(_Bounds);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline typename QuadTree<T, _Capacity, P, _Policy, _Allocator>::node_index QuadTree<T, _Capacity, P, _Policy, _Allocator>::child_by_center(
+        node_index _Node, double _X, double _Y) const
+    {
+        const Node& node = nodes[_Node];
+
+        // children go clockwise from the top left
+        const double x = node.bounds.center_x();
+
+        if (_Y < (double)node.bounds.center_y())
+            return node.children + (_X < x ? 0 : 1);
+
+        return node.children + (_X < x ? 3 : 2);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline typename QuadTree<T, _Capacity, P, _Policy, _Allocator>::node_index QuadTree<T, _Capacity, P, _Policy, _Allocator>::child_for(
+        node_index _Node, const QuadTreeAABB<T>& _Bounds) const
+    {
+        const node_index block = nodes[_Node].children;
+
+        for (node_index i = 0; i < kChildren; i++) {
+            if (nodes[block + i].bounds.intersects(_Bounds))
+                return block + i;
+        }
+
+        return child_by_center(_Node, ((double)_Bounds.left + (double)_Bounds.right) / 2.0,
+            ((double)_Bounds.top + (double)_Bounds.bottom) / 2.0);
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::insert_loose(node_index _Node,
+        const object_ptr& _Object)
+    {
+        const QuadTreeAABB<T>& bounds = _Object->bounds;
+        const size_t depth = loose_depth(bounds);
+        const double x = ((double)bounds.left + (double)bounds.right) / 2.0;
+        const double y = ((double)bounds.top + (double)bounds.bottom) / 2.0;
+
+        if (_Node == kRootNode && !nodes[kRootNode].bounds.intersects(bounds))
+            return false;
+
+        // walks down by center to the depth the object size calls for. a full
+        // node sends the object one level further, max_bounds then covers
+        // the part that sticks out of the loose bounds
+        for (;;) {
+            Node& node = nodes[_Node];
+
+            if (!subdivides(_Node) || (node.level - 1 >= depth && node.object_count < kSplitThreshold)) {
+                place_object(_Node, _Object);
+                adjust_total(_Node, 1);
+
+                grow_max_bounds(_Node, QuadTreeBox<T>(bounds));
+                return true;
+            }
+
+            if (!node.has_children())
+                split(_Node);
+
+            _Node = child_by_center(_Node, x, y);
+        }
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::insert(node_index _Node,
+        const object_ptr& _Object)
+    {
+        // counts are kept in 32 bits
+        if (locations.size() >= kMaxObjects)
+            throw std::length_error("object count exhausted");
+
+        if (is_loose())
+            return insert_loose(_Node, _Object);
+
+        // only the root rejects objects, below it routing may send boxes
+        // without area on a center line into a child they merely touch
+        if (_Node == kRootNode && !nodes[kRootNode].bounds.intersects(_Object->bounds))
+            return false;
+
+        // objects are only stored in leaves, a full leaf hands its objects
+        // down when it splits. leaves that cannot split chain blocks instead
+        while (nodes[_Node].has_children()
+            || (nodes[_Node].object_count >= kSplitThreshold && subdivides(_Node))) {
+            if (!nodes[_Node].has_children())
+                split(_Node);
+
+            _Node = child_for(_Node, _Object->bounds);
+        }
+
+        place_object(_Node, _Object);
+        adjust_total(_Node, 1);
+
+        grow_max_bounds(_Node, QuadTreeBox<T>(_Object->bounds));
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::remove(size_t _Id)
+    {
+        auto it = locations.find(_Id);
+        if (it == locations.end())
+            return false;
+
+        const node_index leaf = it->second.leaf;
+        const size_t slot = it->second.slot;
+        const node_index node = leaves[leaf].owner;
+
+        const object_ptr object = leaves[leaf].objects[slot];
+        const QuadTreeBox<T> bounds = leaves[leaf].object_bounds(slot);
+
+        erase_object(leaf, slot);
+        adjust_total(node, -1);
+
+        mark_dirty(node);
+        merge_underfull(node);
+
+        if (active_subscriptions > 0)
+            notify(object, &bounds, nullptr);
+
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::update(size_t _Id, const QuadTreeAABB<T>& _Bounds,
+        std::vector<node_index>* _Emptied)
+    {
+        auto it = locations.find(_Id);
+        if (it == locations.end())
+            return false;
+
+        const node_index leaf = it->second.leaf;
+        const size_t slot = it->second.slot;
+        const node_index node = leaves[leaf].owner;
+        object_ptr object = leaves[leaf].objects[slot];
+        const QuadTreeBox<T> old_bounds = leaves[leaf].object_bounds(slot);
+        const QuadTreeBox<T> new_bounds(_Bounds);
+
+        // an old box inside the node bounds never widened max_bounds
+        if (!QuadTreeBox<T>(nodes[node].bounds).contains(old_bounds))
+            mark_dirty(node);
+
+        object->bounds = _Bounds;
+
+        if (is_loose() ? loose_fits(node, _Bounds) : nodes[node].bounds.intersects(_Bounds)) {
+            leaves[leaf].set_object(slot, object);
+            grow_max_bounds(node, new_bounds);
+
+            if (active_subscriptions > 0)
+                notify(object, &old_bounds, &new_bounds);
+            return true;
+        }
+
+        erase_object(leaf, slot);
+        adjust_total(node, -1);
+
+        node_index target = nodes[node].root;
+        while (target != kInvalidNode && !(is_loose() ? loose_fits(target, _Bounds)
+            : QuadTreeBox<T>(nodes[target].bounds).contains(_Bounds)))
+            target = nodes[target].root;
+        if (target == kInvalidNode)
+            target = kRootNode;
+
+        // merging may release target, so it runs after the reinsertion
+        bool inserted = insert(target, object);
+
+        if (_Emptied)
+            _Emptied->push_back(node);
+        else
+            merge_underfull(node);
+
+        if (active_subscriptions > 0)
+            notify(object, &old_bounds, inserted ? &new_bounds : nullptr);
+
+        return inserted;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Iterator>
+    inline size_t QuadTree<T, _Capacity, P, _Policy, _Allocator>::update_many(_Iterator _First, _Iterator _Last)
+    {
+        std::vector<node_index> emptied;
+        size_t updated = 0;
+
+        for (; _First != _Last; ++_First) {
+            if (update(_First->first, _First->second, &emptied))
+                updated++;
+        }
+
+        // merges only release blocks, so indices recorded earlier in the
+        // batch stay valid, released nodes are empty leaves
+        for (node_index node : emptied)
+            merge_underfull(node);
+
+        return updated;
+    }
+
+    template<typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    template<typename _Visitor>
+    inline bool QuadTree<T, _Capacity, P, _Policy, _Allocator>::query(node_index _Node, const QuadTreeAABB<T>& _Bounds,
+        _Visitor& _Visit, bool _BoundChecks) const
+    {
+        const Node& node = nodes[_Node];
+
+        NC_QUADTREE_COUNT(nodes_visited, 1);
+        NC_QUADTREE_COUNT(intersection_tests, 1);
+
+        if (node.max_bounds.intersects(_Bounds) || !_BoundChecks) {
+            if (node.has_children()) {
+                if (!query(node.children + 0, _Bounds, _Visit, _BoundChecks)
+                    || !query(node.children + 1, _Bounds, _Visit, _BoundChecks)
+                    || !query(node.children + 2, _Bounds, _Visit, _BoundChecks)
+                    || !query(node.children + 3, _Bounds, _Visit, _BoundChecks))
+                    return false;
+            }
+
+            return scan_node(_Node, _Bounds, [&](const Leaf& _Leaf, size_t _Slot) {
+                return visit_slot(_Visit, _Leaf, _Slot);
+            });
+        }
+
+        return true;
+    }
+
 } // namespace nc
 
-#endif // NC_QUADTREE_H_
\ No newline at end of file
+#endif // NC_QUADTREE_H_
@@ -0,0 +1,289 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_concurrent.h: QuadTree with lock-free readers and a single writer
+
+#ifndef NC_QUADTREE_CONCURRENT_H_
+#define NC_QUADTREE_CONCURRENT_H_
+
+#include "quadtree.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace nc {
+    // keeps two copies of the tree. readers run against the published copy
+    // without taking locks while the writer changes the other one, publishes
+    // it and replays the change on the retired copy once the last reader
+    // that could still see it has left
+    template <typename T = double, size_t _Capacity = 2, typename P = void*>
+    class ConcurrentQuadTree {
+    public:
+        typedef QuadTree<T, _Capacity, P> tree_type;
+        typedef typename tree_type::object_ptr object_ptr;
+    private:
+        // reader counters are striped over cache lines by thread
+        static constexpr size_t kReaderStripes = 64;
+
+        struct alignas(64) ReaderCount {
+            std::atomic<size_t> count{ 0 };
+        };
+
+        tree_type trees[2];
+        std::atomic<unsigned> published{ 0 };
+        mutable ReaderCount readers[2][kReaderStripes];
+
+        std::mutex writer;
+        // set when a batch failed or a replay threw, the standby copy is
+        // then copied from the published one before the next change
+        bool stale = false;
+
+        static size_t stripe() {
+            static thread_local const size_t index =
+                std::hash<std::thread::id>()(std::this_thread::get_id()) % kReaderStripes;
+            return index;
+        }
+
+        // registers the calling thread as a reader of the published copy
+        unsigned enter_read() const {
+            const size_t slot = stripe();
+
+            for (;;) {
+                unsigned version = published.load();
+                readers[version][slot].count.fetch_add(1);
+
+                // the writer may have switched copies between the two loads,
+                // in that case it might not wait for this reader
+                if (published.load() == version)
+                    return version;
+
+                readers[version][slot].count.fetch_sub(1);
+            }
+        }
+
+        void leave_read(unsigned _Version) const {
+            readers[_Version][stripe()].count.fetch_sub(1, std::memory_order_release);
+        }
+
+        // pairs with the seq_cst increment and reload in enter_read(): either
+        // the reader sees the new version or this sees its count. acquire
+        // loads alone could both read the old values
+        void wait_for_readers(unsigned _Version) const {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            for (size_t i = 0; i < kReaderStripes; i++) {
+                while (readers[_Version][i].count.load() != 0)
+                    std::this_thread::yield();
+            }
+        }
+
+        struct ReadGuard {
+            const ConcurrentQuadTree& owner;
+            unsigned version;
+
+            ReadGuard(const ConcurrentQuadTree& _Owner) : owner(_Owner), version(_Owner.enter_read()) {}
+            ~ReadGuard() { owner.leave_read(version); }
+        };
+    public:
+        ConcurrentQuadTree() {}
+
+        ConcurrentQuadTree(const QuadTreeAABB<T>& _Bounds) {
+            trees[0].set_bounds(_Bounds);
+            trees[1].set_bounds(_Bounds);
+        }
+
+        ConcurrentQuadTree(const ConcurrentQuadTree&) = delete;
+        ConcurrentQuadTree& operator=(const ConcurrentQuadTree&) = delete;
+
+        // records the changes of one modify() call. each change is applied
+        // to the standby copy right away and only logged once it took
+        // effect, the log is replayed on the other copy so both copies end
+        // up identical. an operation that throws fails the whole batch
+        class Batch {
+        public:
+            bool insert(const object_ptr& _Object) {
+                return apply(Op{ _Object, _Object->id });
+            }
+
+            bool remove(size_t _Id) {
+                return apply(Op{ nullptr, _Id });
+            }
+
+            bool remove(const object_ptr& _Object) {
+                return remove(_Object->id);
+            }
+
+            bool replace(const object_ptr& _Object) {
+                remove(_Object->id);
+                return insert(_Object);
+            }
+
+            // the standby copy with the changes so far, readers do not see it
+            const tree_type& get_tree() const {
+                return tree;
+            }
+        private:
+            friend class ConcurrentQuadTree;
+
+            // an insert carries its object, a remove only the id
+            struct Op {
+                object_ptr object;
+                size_t id;
+            };
+
+            Batch(tree_type& _Tree) : tree(_Tree) {}
+
+            static bool run(tree_type& _Tree, const Op& _Op) {
+                return _Op.object ? _Tree.insert(_Op.object) : _Tree.remove(_Op.id);
+            }
+
+            bool apply(const Op& _Op) {
+                if (failed)
+                    throw std::logic_error("batch used after a failed operation");
+
+                // the log has room before the tree changes, so a change that
+                // took effect is always recorded
+                log.reserve(log.size() + 1);
+
+                bool changed;
+                try {
+                    changed = run(tree, _Op);
+                }
+                catch (...) {
+                    failed = true;
+                    throw;
+                }
+
+                if (changed)
+                    log.push_back(_Op);
+                return changed;
+            }
+
+            void replay(tree_type& _Tree) const {
+                for (const Op& op : log)
+                    run(_Tree, op);
+            }
+
+            tree_type& tree;
+            std::vector<Op> log;
+            bool failed = false;
+        };
+
+    private:
+        // publishes the standby copy and brings the retired one up to date.
+        // the changes are visible at that point, so a replay that throws
+        // only leaves the retired copy to be resynchronized later
+        void publish(const Batch& _Batch, unsigned _Current) noexcept {
+            published.store(_Current ^ 1);
+            wait_for_readers(_Current);
+
+            try {
+                _Batch.replay(trees[_Current]);
+            }
+            catch (...) {
+                stale = true;
+            }
+        }
+
+    public:
+        // calls _Modify(Batch&) once. readers see either none or all of the
+        // changes, so batching several operations into one call also
+        // publishes once. when _Modify throws or one of its operations
+        // failed nothing is published and the standby copy is restored from
+        // the published one. returns the result of _Modify
+        template <typename _Func>
+        auto modify(_Func&& _Modify) {
+            std::lock_guard<std::mutex> lock(writer);
+
+            const unsigned current = published.load();
+            const unsigned standby = current ^ 1;
+
+            // readers only read the published copy as well
+            if (stale) {
+                trees[standby] = trees[current];
+                stale = false;
+            }
+
+            Batch batch(trees[standby]);
+
+            try {
+                if constexpr (std::is_void_v<decltype(_Modify(batch))>) {
+                    _Modify(batch);
+                    if (batch.failed)
+                        throw std::runtime_error("batch operation failed");
+
+                    publish(batch, current);
+                }
+                else {
+                    auto result = _Modify(batch);
+                    if (batch.failed)
+                        throw std::runtime_error("batch operation failed");
+
+                    publish(batch, current);
+                    return result;
+                }
+            }
+            catch (...) {
+                stale = true;
+                throw;
+            }
+        }
+
+        bool insert(const object_ptr& _Object) {
+            return modify([&](Batch& _Batch) { return _Batch.insert(_Object); });
+        }
+
+        bool remove(size_t _Id) {
+            return modify([&](Batch& _Batch) { return _Batch.remove(_Id); });
+        }
+
+        bool remove(const object_ptr& _Object) {
+            return remove(_Object->id);
+        }
+
+        // replaces the stored object with the id of _Object. objects are
+        // shared by both copies and readers, so moving an object means
+        // publishing a new QuadTreeObject rather than changing its bounds
+        bool replace(const object_ptr& _Object) {
+            return modify([&](Batch& _Batch) { return _Batch.replace(_Object); });
+        }
+
+        // runs _Read(const tree_type&) against the published copy, the copy
+        // stays unchanged until _Read returns
+        template <typename _Func>
+        auto read(_Func&& _Read) const {
+            ReadGuard guard(*this);
+            return _Read(static_cast<const tree_type&>(trees[guard.version]));
+        }
+
+        template <typename _Visitor>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit,
+            bool _BoundChecks = true) const {
+            ReadGuard guard(*this);
+            return trees[guard.version].query(_Boundaries, _Visit, _BoundChecks);
+        }
+
+        void query(const QuadTreeAABB<T>& _Boundaries,
+            std::vector<object_ptr>& _Objects,
+            bool _BoundChecks = true) const {
+            ReadGuard guard(*this);
+            trees[guard.version].query(_Boundaries, _Objects, _BoundChecks);
+        }
+
+        size_t get_total_objects() const {
+            ReadGuard guard(*this);
+            return trees[guard.version].get_total_objects();
+        }
+    };
+} // namespace nc
+
+#endif // NC_QUADTREE_CONCURRENT_H_
@@ -0,0 +1,377 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_linear.h: pointerless quadtree stored as a morton sorted array
+
+#ifndef NC_QUADTREE_LINEAR_H_
+#define NC_QUADTREE_LINEAR_H_
+
+#include "quadtree.h"
+
+namespace nc {
+    // every object is keyed by a cell of the implicit quadtree over the
+    // bounds, halved like QuadTree::split(): the cell holding the object's
+    // center on the deepest level whose cells are still larger than the
+    // object, so objects overhang their cell by less than its size like in
+    // loose mode. a key holds the morton code of the cell's first corner at
+    // full depth followed by the cell level, so sorting puts each cell right
+    // before its descendants and every subtree is one contiguous range of
+    // the array. suited for mostly static data, insert() and remove() shift
+    // the arrays
+    template <typename T = double, typename P = void*>
+    class LinearQuadTree {
+    public:
+        typedef QuadTreeObject<T, P> object_type;
+        typedef std::shared_ptr<object_type> object_ptr;
+
+        // deepest cell level, cells at this level are 1 / 2^kMaxDepth of the bounds
+        static constexpr size_t kMaxDepth = 28;
+    private:
+        static constexpr size_t kLevelBits = 5;
+        // ranges up to this size are scanned instead of split further
+        static constexpr size_t kScanThreshold = 64;
+        static constexpr size_t kParallelBuildThreshold = 1 << 16;
+
+        QuadTreeAABB<T> bounds;
+
+        // sorted keys with the objects as structure of arrays in the same order
+        std::vector<uint64_t> keys;
+        std::vector<T> object_left;
+        std::vector<T> object_top;
+        std::vector<T> object_right;
+        std::vector<T> object_bottom;
+        std::vector<P> payloads;
+        std::vector<object_ptr> objects;
+
+        // grid coordinate of _Value, clamped to the bounds
+        static uint32_t quantize(double _Value, double _Min, double _Max) {
+            const double scale = (double)((uint64_t)1 << kMaxDepth);
+            double cell = (_Value - _Min) / (_Max - _Min) * scale;
+            cell = std::min(std::max(cell, 0.0), scale - 1.0);
+            return static_cast<uint32_t>(cell);
+        }
+
+        static uint64_t spread(uint64_t _Value) {
+            _Value &= 0xffffffffull;
+            _Value = (_Value | (_Value << 16)) & 0x0000ffff0000ffffull;
+            _Value = (_Value | (_Value << 8)) & 0x00ff00ff00ff00ffull;
+            _Value = (_Value | (_Value << 4)) & 0x0f0f0f0f0f0f0f0full;
+            _Value = (_Value | (_Value << 2)) & 0x3333333333333333ull;
+            _Value = (_Value | (_Value << 1)) & 0x5555555555555555ull;
+            return _Value;
+        }
+
+        static uint64_t make_key(uint32_t _X, uint32_t _Y, size_t _Level) {
+            return ((spread(_X) | (spread(_Y) << 1)) << kLevelBits) | _Level;
+        }
+
+        // grid rectangle covered by _Bounds, inclusive
+        struct GridBox {
+            uint32_t left, top, right, bottom;
+        };
+
+        template <typename _Box>
+        GridBox grid_box(const _Box& _Bounds) const {
+            return GridBox{
+                quantize((double)_Bounds.left, (double)bounds.left, (double)bounds.right),
+                quantize((double)_Bounds.top, (double)bounds.top, (double)bounds.bottom),
+                quantize((double)_Bounds.right, (double)bounds.left, (double)bounds.right),
+                quantize((double)_Bounds.bottom, (double)bounds.top, (double)bounds.bottom)
+            };
+        }
+
+        uint64_t object_key(const QuadTreeAABB<T>& _Bounds) const {
+            const GridBox grid = grid_box(_Bounds);
+
+            // the level is picked by size, cells at it are larger than the
+            // object. keying by the center instead of the smallest enclosing
+            // cell keeps objects straddling a split line out of the big cells
+            uint32_t extent = std::max(grid.right - grid.left, grid.bottom - grid.top);
+            size_t shift = 0;
+            while (extent) {
+                extent >>= 1;
+                shift++;
+            }
+
+            const uint32_t mask = ~(uint32_t)0 << shift;
+            const uint32_t x = grid.left + (grid.right - grid.left) / 2;
+            const uint32_t y = grid.top + (grid.bottom - grid.top) / 2;
+            return make_key(x & mask, y & mask, kMaxDepth - shift);
+        }
+
+        void set_object(size_t _Index, uint64_t _Key, const object_ptr& _Object) {
+            keys[_Index] = _Key;
+            object_left[_Index] = _Object->bounds.left;
+            object_top[_Index] = _Object->bounds.top;
+            object_right[_Index] = _Object->bounds.right;
+            object_bottom[_Index] = _Object->bounds.bottom;
+            payloads[_Index] = _Object->user_data;
+            objects[_Index] = _Object;
+        }
+
+        void resize(size_t _Count) {
+            keys.resize(_Count);
+            object_left.resize(_Count);
+            object_top.resize(_Count);
+            object_right.resize(_Count);
+            object_bottom.resize(_Count);
+            payloads.resize(_Count);
+            objects.resize(_Count);
+        }
+
+        template <typename _Visitor>
+        using hit_type = std::conditional_t<std::is_invocable_v<_Visitor&, const object_ptr&>, object_ptr, P>;
+
+        template <typename _Visitor>
+        bool visit_index(_Visitor& _Visit, size_t _Index) const {
+            if constexpr (std::is_same_v<hit_type<_Visitor>, object_ptr>)
+                return detail::visit(_Visit, objects[_Index]);
+            else
+                return detail::visit(_Visit, payloads[_Index]);
+        }
+
+        // whether objects of the cell at (_X, _Y) or its descendants can
+        // reach _Grid. they are smaller than the cell and centered in it, so
+        // they overhang it by at most half its size
+        static bool cell_overlaps(uint32_t _X, uint32_t _Y, size_t _Level, const GridBox& _Grid) {
+            const int64_t size = (int64_t)1 << (kMaxDepth - _Level);
+            const int64_t margin = size / 2;
+
+            return (int64_t)_X - margin <= (int64_t)_Grid.right && (int64_t)_X + size + margin > (int64_t)_Grid.left
+                && (int64_t)_Y - margin <= (int64_t)_Grid.bottom && (int64_t)_Y + size + margin > (int64_t)_Grid.top;
+        }
+
+        template <typename _Visitor>
+        bool scan(size_t _Begin, size_t _End, const QuadTreeAABB<T>& _Bounds, _Visitor& _Visit) const;
+
+        template <typename _Visitor>
+        bool query(uint32_t _X, uint32_t _Y, size_t _Level, size_t _Begin, size_t _End,
+            const GridBox& _Grid, const QuadTreeAABB<T>& _Bounds, _Visitor& _Visit) const;
+    public:
+        LinearQuadTree() {}
+        LinearQuadTree(const QuadTreeAABB<T>& _Bounds) : bounds(_Bounds) {}
+
+        template <typename _Iterator>
+        LinearQuadTree(const QuadTreeAABB<T>& _Bounds, _Iterator _First, _Iterator _Last) : bounds(_Bounds) {
+            build(_First, _Last);
+        }
+
+        // only allowed while the tree is empty
+        void set_bounds(const QuadTreeAABB<T>& _Bounds) { bounds = _Bounds; }
+        const QuadTreeAABB<T>& get_bounds() const { return bounds; }
+
+        // replaces the contents with a range of object_ptr. keys are computed
+        // and sorted on _Threads threads (all hardware threads when 0) for
+        // large inputs. objects not intersecting the bounds are skipped,
+        // returns the number of objects stored
+        template <typename _Iterator>
+        size_t build(_Iterator _First, _Iterator _Last, size_t _Threads = 0);
+
+        // sorted insert, linear in the number of objects
+        bool insert(const object_ptr& _Object);
+
+        // finds _Object by its bounds and id, which must not have changed
+        // since it was inserted
+        bool remove(const object_ptr& _Object);
+
+        // calls _Visit(const object_ptr&) or _Visit(const P&) for every object
+        // intersecting _Boundaries. the query box is split into the cells of
+        // the implicit tree, each a contiguous key range found by binary
+        // search. a visitor returning false stops the query
+        template <typename _Visitor, typename = std::enable_if_t<std::is_invocable_v<_Visitor&,
+            const object_ptr&> || std::is_invocable_v<_Visitor&, const P&>>>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit) const {
+            return query(0, 0, 0, 0, keys.size(), grid_box(_Boundaries), _Boundaries, _Visit);
+        }
+
+        void query(const QuadTreeAABB<T>& _Boundaries, std::vector<object_ptr>& _Objects) const {
+            query(_Boundaries, [&](const object_ptr& _Object) { _Objects.push_back(_Object); });
+        }
+
+        size_t get_total_objects() const { return keys.size(); }
+
+        void clear() { resize(0); }
+    };
+
+    template <typename T, typename P>
+    template <typename _Iterator>
+    inline size_t LinearQuadTree<T, P>::build(_Iterator _First, _Iterator _Last, size_t _Threads)
+    {
+        std::vector<object_ptr> input;
+        for (; _First != _Last; ++_First) {
+            if (bounds.intersects((*_First)->bounds))
+                input.push_back(*_First);
+        }
+
+        if (_Threads == 0)
+            _Threads = detail::default_threads();
+        if (input.size() < kParallelBuildThreshold)
+            _Threads = 1;
+
+        std::vector<std::pair<uint64_t, uint32_t>> order(input.size());
+        const size_t chunks = std::min(_Threads, std::max<size_t>(input.size(), 1));
+
+        auto chunk_begin = [&](size_t _Chunk) { return _Chunk * input.size() / chunks; };
+
+        // keys and a sort per chunk in parallel, then merged pairwise
+        detail::parallel_for(chunks, _Threads, [&](size_t _Chunk) {
+            for (size_t i = chunk_begin(_Chunk); i < chunk_begin(_Chunk + 1); i++)
+                order[i] = { object_key(input[i]->bounds), static_cast<uint32_t>(i) };
+
+            std::sort(order.begin() + chunk_begin(_Chunk), order.begin() + chunk_begin(_Chunk + 1));
+        });
+
+        for (size_t width = 1; width < chunks; width *= 2) {
+            for (size_t i = 0; i + width < chunks; i += 2 * width) {
+                std::inplace_merge(order.begin() + chunk_begin(i),
+                    order.begin() + chunk_begin(i + width),
+                    order.begin() + chunk_begin(std::min(i + 2 * width, chunks)));
+            }
+        }
+
+        resize(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            set_object(i, order[i].first, input[order[i].second]);
+
+        return order.size();
+    }
+
+    template <typename T, typename P>
+    inline bool LinearQuadTree<T, P>::insert(const object_ptr& _Object)
+    {
+        if (!bounds.intersects(_Object->bounds))
+            return false;
+
+        const uint64_t key = object_key(_Object->bounds);
+        const size_t index = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+
+        keys.insert(keys.begin() + index, key);
+        object_left.insert(object_left.begin() + index, _Object->bounds.left);
+        object_top.insert(object_top.begin() + index, _Object->bounds.top);
+        object_right.insert(object_right.begin() + index, _Object->bounds.right);
+        object_bottom.insert(object_bottom.begin() + index, _Object->bounds.bottom);
+        payloads.insert(payloads.begin() + index, _Object->user_data);
+        objects.insert(objects.begin() + index, _Object);
+        return true;
+    }
+
+    template <typename T, typename P>
+    inline bool LinearQuadTree<T, P>::remove(const object_ptr& _Object)
+    {
+        const uint64_t key = object_key(_Object->bounds);
+        auto range = std::equal_range(keys.begin(), keys.end(), key);
+
+        for (auto it = range.first; it != range.second; ++it) {
+            const size_t index = it - keys.begin();
+
+            if (objects[index]->id == _Object->id) {
+                keys.erase(keys.begin() + index);
+                object_left.erase(object_left.begin() + index);
+                object_top.erase(object_top.begin() + index);
+                object_right.erase(object_right.begin() + index);
+                object_bottom.erase(object_bottom.begin() + index);
+                payloads.erase(payloads.begin() + index);
+                objects.erase(objects.begin() + index);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template <typename T, typename P>
+    template <typename _Visitor>
+    inline bool LinearQuadTree<T, P>::scan(size_t _Begin, size_t _End,
+        const QuadTreeAABB<T>& _Bounds, _Visitor& _Visit) const
+    {
+        for (size_t base = _Begin; base < _End; base += detail::kMaskBits) {
+            uint64_t mask = detail::intersect_mask(object_left.data() + base, object_top.data() + base,
+                object_right.data() + base, object_bottom.data() + base,
+                std::min<size_t>(detail::kMaskBits, _End - base),
+                _Bounds.left, _Bounds.top, _Bounds.right, _Bounds.bottom);
+
+            while (mask) {
+                const size_t i = base + detail::count_trailing_zeros(mask);
+                mask &= mask - 1;
+
+                if (!visit_index(_Visit, i))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename T, typename P>
+    template <typename _Visitor>
+    inline bool LinearQuadTree<T, P>::query(uint32_t _X, uint32_t _Y, size_t _Level,
+        size_t _Begin, size_t _End, const GridBox& _Grid, const QuadTreeAABB<T>& _Bounds,
+        _Visitor& _Visit) const
+    {
+        if (_Begin == _End)
+            return true;
+
+        // the cell spans [_X, _X + size) x [_Y, _Y + size) grid units and
+        // keys [_Begin, _End). grid boxes are conservative, objects are
+        // tested exactly by scan()
+        const uint64_t last = ((uint64_t)1 << (kMaxDepth - _Level)) - 1;
+
+        if (!cell_overlaps(_X, _Y, _Level, _Grid))
+            return true;
+
+        const bool inside = _X >= _Grid.left && _X + last <= _Grid.right
+            && _Y >= _Grid.top && _Y + last <= _Grid.bottom;
+
+        if (inside || _Level == kMaxDepth || _End - _Begin <= kScanThreshold)
+            return scan(_Begin, _End, _Bounds, _Visit);
+
+        // objects keyed to this very cell sort first
+        const uint64_t own = make_key(_X, _Y, _Level);
+        size_t begin = _Begin;
+        while (begin < _End && keys[begin] == own)
+            begin++;
+
+        if (!scan(_Begin, begin, _Bounds, _Visit))
+            return false;
+
+        // children in morton order, each ends where the next one's keys
+        // start. ranges are only searched for children that can overlap
+        const uint32_t half = static_cast<uint32_t>((last + 1) / 2);
+        bool known = true;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            const uint32_t x = _X + (i & 1) * half;
+            const uint32_t y = _Y + (i >> 1) * half;
+
+            if (!cell_overlaps(x, y, _Level + 1, _Grid)) {
+                known = false;
+                continue;
+            }
+
+            if (!known)
+                begin = std::lower_bound(keys.begin() + begin, keys.begin() + _End,
+                    make_key(x, y, 0)) - keys.begin();
+
+            size_t end = _End;
+            if (i < 3) {
+                const uint32_t next = i + 1;
+                const uint64_t next_key = make_key(_X + (next & 1) * half, _Y + (next >> 1) * half, 0);
+                end = std::lower_bound(keys.begin() + begin, keys.begin() + _End, next_key) - keys.begin();
+            }
+
+            if (!query(x, y, _Level + 1, begin, end, _Grid, _Bounds, _Visit))
+                return false;
+
+            begin = end;
+            known = true;
+        }
+
+        return true;
+    }
+} // namespace nc
+
+#endif // NC_QUADTREE_LINEAR_H_
@@ -0,0 +1,433 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_point.h: QuadTree specialized for zero-area point data
+
+#ifndef NC_QUADTREE_POINT_H_
+#define NC_QUADTREE_POINT_H_
+
+#include "quadtree.h"
+
+namespace nc {
+    template <typename T, typename P = uint32_t>
+    class QuadTreePoint {
+    public:
+        QuadTreePoint() {}
+        QuadTreePoint(T _X, T _Y, const P& _Data) : x(_X), y(_Y), data(_Data) {}
+
+        T x, y;
+        // stored inline next to the coordinates, also identifies the point
+        // on removal together with its position
+        P data;
+    };
+
+    // points never overhang a node, so there is no max_bounds to maintain
+    // and every point lives in exactly one leaf found by its position.
+    // points and payloads are kept by value as structure of arrays in a
+    // pool of leaves, so internal nodes stay small like in QuadTree
+    template <typename T = double, size_t _Capacity = 8, typename P = uint32_t>
+    class PointQuadTree {
+    public:
+        typedef uint32_t node_index;
+        typedef QuadTreePoint<T, P> point_type;
+
+        static constexpr node_index kInvalidNode = std::numeric_limits<node_index>::max();
+        static constexpr node_index kRootNode = 0;
+    private:
+        static constexpr size_t kChildren = 4;
+        static constexpr size_t kMergeThreshold = _Capacity / 2;
+        // nodes deeper than this are not split, a full one chains further
+        // leaf blocks so identical points never recurse
+        static constexpr size_t kMaxDepth = 48;
+
+        static constexpr bool kBatchScan = detail::simd_lanes<T>() > 1
+            && _Capacity >= detail::simd_lanes<T>();
+
+        struct Node {
+            QuadTreeBox<T> bounds;
+
+            node_index children = kInvalidNode;
+            node_index root = kInvalidNode;
+
+            // first block of the points in the leaf pool, kInvalidNode for
+            // internal and empty nodes
+            node_index leaf = kInvalidNode;
+
+            uint32_t level = 1;
+            // points in the leaf, or in the whole subtree for internal nodes
+            uint32_t count = 0;
+
+            bool has_children() const { return children != kInvalidNode; }
+        };
+
+        // points of a leaf node, only nodes that cannot split chain more
+        // than one block. every block after the first is full
+        struct Leaf {
+            T x[_Capacity];
+            T y[_Capacity];
+            P data[_Capacity];
+
+            uint32_t count = 0;
+            node_index next = kInvalidNode;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<node_index> free_blocks;
+
+        std::vector<Leaf> leaves;
+        std::vector<node_index> free_leaves;
+
+        node_index allocate_block() {
+            if (!free_blocks.empty()) {
+                node_index block = free_blocks.back();
+                free_blocks.pop_back();
+                return block;
+            }
+
+            if (nodes.size() + kChildren > kInvalidNode)
+                throw std::length_error("node pool exhausted");
+
+            node_index block = static_cast<node_index>(nodes.size());
+            nodes.resize(nodes.size() + kChildren);
+            return block;
+        }
+
+        node_index allocate_leaf() {
+            node_index leaf;
+
+            if (!free_leaves.empty()) {
+                leaf = free_leaves.back();
+                free_leaves.pop_back();
+            }
+            else {
+                if (leaves.size() >= kInvalidNode)
+                    throw std::length_error("leaf pool exhausted");
+
+                leaf = static_cast<node_index>(leaves.size());
+                leaves.emplace_back();
+            }
+
+            leaves[leaf].count = 0;
+            leaves[leaf].next = kInvalidNode;
+            return leaf;
+        }
+
+        void release_leaf(node_index _Node) {
+            for (node_index leaf = nodes[_Node].leaf; leaf != kInvalidNode; leaf = leaves[leaf].next)
+                free_leaves.push_back(leaf);
+
+            nodes[_Node].leaf = kInvalidNode;
+        }
+
+        // stores the point in the first block of _Node, a full one gets a
+        // new first block. node counts are up to the caller
+        void append(node_index _Node, T _X, T _Y, const P& _Data) {
+            node_index leaf = nodes[_Node].leaf;
+
+            if (leaf == kInvalidNode || leaves[leaf].count == _Capacity) {
+                // may grow the pool, so leaves are only referenced after allocation
+                const node_index head = allocate_leaf();
+                leaves[head].next = leaf;
+                nodes[_Node].leaf = leaf = head;
+            }
+
+            Leaf& block = leaves[leaf];
+            block.x[block.count] = _X;
+            block.y[block.count] = _Y;
+            block.data[block.count] = _Data;
+            block.count++;
+        }
+
+        // false at kMaxDepth or once the coordinates cannot be halved any
+        // further, such nodes chain leaf blocks instead of splitting
+        bool subdivides(node_index _Node) const {
+            const QuadTreeBox<T>& bounds = nodes[_Node].bounds;
+            const T x = bounds.center_x();
+            const T y = bounds.center_y();
+
+            return nodes[_Node].level <= kMaxDepth
+                && bounds.left < x && x < bounds.right
+                && bounds.top < y && y < bounds.bottom;
+        }
+
+        node_index child_of(node_index _Node, T _X, T _Y) const {
+            const QuadTreeBox<T>& bounds = nodes[_Node].bounds;
+            const T x = bounds.center_x();
+            const T y = bounds.center_y();
+
+            // children go clockwise from the top left like QuadTree::split()
+            if (_Y < y)
+                return nodes[_Node].children + (_X < x ? 0 : 1);
+
+            return nodes[_Node].children + (_X < x ? 3 : 2);
+        }
+
+        void split(node_index _Node);
+        void merge(node_index _Node);
+
+        template <typename _Visitor>
+        bool query(node_index _Node, const QuadTreeAABB<T>& _Boundaries, _Visitor& _Visit) const;
+    public:
+        PointQuadTree() {
+            nodes.resize(1);
+        }
+
+        PointQuadTree(const QuadTreeAABB<T>& _Bounds) {
+            nodes.resize(1);
+            set_bounds(_Bounds);
+        }
+
+        // only allowed while the tree is empty
+        void set_bounds(const QuadTreeAABB<T>& _Bounds) {
+            nodes[kRootNode].bounds = _Bounds;
+        }
+
+        QuadTreeAABB<T> get_bounds(node_index _Node = kRootNode) const {
+            return nodes[_Node].bounds.to_aabb();
+        }
+
+        // points outside [left, right) x [top, bottom) are rejected
+        bool insert(const point_type& _Point);
+
+        // removes one point at the same position with an equal payload
+        bool remove(const point_type& _Point);
+
+        // calls _Visit(const point_type&) for every point _Boundaries
+        // contains, a visitor returning false stops the query
+        template <typename _Visitor>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit) const {
+            return query(kRootNode, _Boundaries, _Visit);
+        }
+
+        void query(const QuadTreeAABB<T>& _Boundaries, std::vector<point_type>& _Points) const {
+            auto append = [&](const point_type& _Point) {
+                _Points.push_back(_Point);
+                return true;
+            };
+            query(kRootNode, _Boundaries, append);
+        }
+
+        bool has_children_(node_index _Node = kRootNode) const { return nodes[_Node].has_children(); }
+        node_index get_children(node_index _Node = kRootNode) const { return nodes[_Node].children; }
+
+        size_t get_total_points() const { return nodes[kRootNode].count; }
+    };
+
+    template<typename T, size_t _Capacity, typename P>
+    inline void PointQuadTree<T, _Capacity, P>::split(node_index _Node)
+    {
+        const node_index block = allocate_block();
+        const QuadTreeBox<T> bounds = nodes[_Node].bounds;
+        const T x = bounds.center_x();
+        const T y = bounds.center_y();
+
+        const QuadTreeBox<T> child_bounds[kChildren] = {
+            QuadTreeBox<T>(bounds.left, bounds.top, x, y),
+            QuadTreeBox<T>(x, bounds.top, bounds.right, y),
+            QuadTreeBox<T>(x, y, bounds.right, bounds.bottom),
+            QuadTreeBox<T>(bounds.left, y, x, bounds.bottom)
+        };
+
+        for (size_t i = 0; i < kChildren; i++) {
+            Node& child = nodes[block + i];
+
+            child.bounds = child_bounds[i];
+            child.children = kInvalidNode;
+            child.root = _Node;
+            child.leaf = kInvalidNode;
+            child.level = nodes[_Node].level + 1;
+            child.count = 0;
+        }
+
+        nodes[_Node].children = block;
+
+        // points move down, internal nodes only keep the subtree count.
+        // nodes that split hold a single block
+        const node_index leaf = nodes[_Node].leaf;
+        const size_t count = leaf != kInvalidNode ? leaves[leaf].count : 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const T px = leaves[leaf].x[i];
+            const T py = leaves[leaf].y[i];
+            const P data = leaves[leaf].data[i];
+            const node_index child = child_of(_Node, px, py);
+
+            append(child, px, py, data);
+            nodes[child].count++;
+        }
+
+        release_leaf(_Node);
+    }
+
+    template<typename T, size_t _Capacity, typename P>
+    inline void PointQuadTree<T, _Capacity, P>::merge(node_index _Node)
+    {
+        // gathers the subtree back into _Node, callers make sure it fits
+        if (!nodes[_Node].has_children())
+            return;
+
+        const node_index block = nodes[_Node].children;
+
+        for (size_t i = 0; i < kChildren; i++) {
+            const node_index child = block + static_cast<node_index>(i);
+            merge(child);
+
+            for (node_index leaf = nodes[child].leaf; leaf != kInvalidNode; leaf = leaves[leaf].next) {
+                for (size_t j = 0; j < leaves[leaf].count; j++) {
+                    const T x = leaves[leaf].x[j];
+                    const T y = leaves[leaf].y[j];
+                    const P data = leaves[leaf].data[j];
+
+                    append(_Node, x, y, data);
+                }
+            }
+
+            release_leaf(child);
+            nodes[child].count = 0;
+        }
+
+        // the count of _Node already covers the subtree
+        nodes[_Node].children = kInvalidNode;
+        free_blocks.push_back(block);
+    }
+
+    template<typename T, size_t _Capacity, typename P>
+    inline bool PointQuadTree<T, _Capacity, P>::insert(const point_type& _Point)
+    {
+        const QuadTreeBox<T>& root = nodes[kRootNode].bounds;
+
+        if (!(_Point.x >= root.left && _Point.x < root.right
+            && _Point.y >= root.top && _Point.y < root.bottom))
+            return false;
+
+        node_index node = kRootNode;
+
+        // full leaves split on the way down unless they cannot, those chain
+        // another block
+        while (nodes[node].has_children() || (nodes[node].count >= _Capacity && subdivides(node))) {
+            if (!nodes[node].has_children())
+                split(node);
+
+            node = child_of(node, _Point.x, _Point.y);
+        }
+
+        // the counts on the path are only taken once nothing can throw
+        append(node, _Point.x, _Point.y, _Point.data);
+
+        for (node_index n = node; n != kInvalidNode; n = nodes[n].root)
+            nodes[n].count++;
+
+        return true;
+    }
+
+    template<typename T, size_t _Capacity, typename P>
+    inline bool PointQuadTree<T, _Capacity, P>::remove(const point_type& _Point)
+    {
+        node_index node = kRootNode;
+
+        while (nodes[node].has_children())
+            node = child_of(node, _Point.x, _Point.y);
+
+        for (node_index leaf = nodes[node].leaf; leaf != kInvalidNode; leaf = leaves[leaf].next) {
+            Leaf& block = leaves[leaf];
+
+            for (size_t i = 0; i < block.count; i++) {
+                if (!(block.x[i] == _Point.x && block.y[i] == _Point.y && block.data[i] == _Point.data))
+                    continue;
+
+                // the first block is the only one that is not full, its
+                // last point fills the hole
+                const node_index first = nodes[node].leaf;
+                Leaf& head = leaves[first];
+                const size_t last = head.count - 1;
+
+                block.x[i] = head.x[last];
+                block.y[i] = head.y[last];
+                block.data[i] = head.data[last];
+
+                if (--head.count == 0) {
+                    nodes[node].leaf = head.next;
+                    free_leaves.push_back(first);
+                }
+
+                // fix the counts up the path and merge the highest subtree
+                // that dropped to the threshold
+                node_index target = kInvalidNode;
+                for (node_index n = node; n != kInvalidNode; n = nodes[n].root) {
+                    nodes[n].count--;
+
+                    if (nodes[n].has_children() && nodes[n].count <= kMergeThreshold)
+                        target = n;
+                }
+
+                if (target != kInvalidNode)
+                    merge(target);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template<typename T, size_t _Capacity, typename P>
+    template<typename _Visitor>
+    inline bool PointQuadTree<T, _Capacity, P>::query(node_index _Node,
+        const QuadTreeAABB<T>& _Bounds, _Visitor& _Visit) const
+    {
+        const Node& node = nodes[_Node];
+
+        if (!node.bounds.intersects(_Bounds) || node.count == 0)
+            return true;
+
+        if (node.has_children()) {
+            for (size_t i = 0; i < kChildren; i++) {
+                if (!query(node.children + static_cast<node_index>(i), _Bounds, _Visit))
+                    return false;
+            }
+
+            return true;
+        }
+
+        for (node_index leaf = node.leaf; leaf != kInvalidNode; leaf = leaves[leaf].next) {
+            const Leaf& block = leaves[leaf];
+
+            auto emit = [&](size_t _Slot) {
+                return detail::visit(_Visit, point_type(block.x[_Slot], block.y[_Slot], block.data[_Slot]));
+            };
+
+            if constexpr (kBatchScan) {
+                // a point is a box with no extent, so the box kernel performs
+                // exactly the strict QuadTreeAABB::contains() test
+                for (size_t base = 0; base < block.count; base += detail::kMaskBits) {
+                    uint64_t mask = detail::intersect_mask(block.x + base, block.y + base,
+                        block.x + base, block.y + base,
+                        std::min<size_t>(block.count - base, detail::kMaskBits),
+                        _Bounds.left, _Bounds.top, _Bounds.right, _Bounds.bottom);
+
+                    while (mask) {
+                        const size_t slot = base + detail::count_trailing_zeros(mask);
+                        mask &= mask - 1;
+
+                        if (!emit(slot))
+                            return false;
+                    }
+                }
+            }
+            else {
+                for (size_t i = 0; i < block.count; i++) {
+                    if (_Bounds.contains(block.x[i], block.y[i]) && !emit(i))
+                        return false;
+                }
+            }
+        }
+
+        return true;
+    }
+} // namespace nc
+
+#endif // NC_QUADTREE_POINT_H_
@@ -0,0 +1,491 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_sharded.h: QuadTree partitioned into independently locked shards
+
+#ifndef NC_QUADTREE_SHARDED_H_
+#define NC_QUADTREE_SHARDED_H_
+
+#include "quadtree.h"
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace nc {
+    // splits the root bounds _Depth times like QuadTree::split() and gives
+    // every resulting region its own tree and lock, so writers in different
+    // regions no longer wait for each other. each object goes to exactly one
+    // region, the first quadrant in split() order its box intersects on
+    // every level, so a box straddling a center line belongs to only one
+    // side. a shard's max_bounds therefore can extend past its
+    // get_shard_bounds(), and queries visit the shards whose max_bounds
+    // overlap rather than those whose region does. shard_for() and
+    // get_shard_bounds() expose the partition, a deployment owning shards
+    // in separate processes routes requests with the same rule. boxes
+    // without area lying exactly on a shard border intersect no shard and
+    // are rejected like boxes on the root border. the shard of every id is
+    // indexed, so calls by id do not search the shards
+    template <typename T = double, size_t _Capacity = 2, typename P = void*,
+        typename _Policy = QuadTreePolicy<_Capacity>>
+    class ShardedQuadTree {
+    public:
+        typedef QuadTree<T, _Capacity, P, _Policy> tree_type;
+        typedef typename tree_type::object_ptr object_ptr;
+
+        static constexpr size_t kInvalidShard = std::numeric_limits<size_t>::max();
+    private:
+        static constexpr size_t kChildren = 4;
+
+        struct Shard {
+            tree_type tree;
+            mutable std::shared_mutex lock;
+        };
+
+        QuadTreeAABB<T> bounds;
+        size_t depth = 0;
+        std::unique_ptr<Shard[]> shards;
+        size_t shard_count = 1;
+
+        // id to shard. taken after shard locks and never held while waiting
+        // for one, so it cannot deadlock with them
+        std::unordered_map<size_t, size_t> owners;
+        mutable std::shared_mutex owners_lock;
+
+        // quadrant _Index of _Bounds in the order split() uses, clockwise
+        // from the top left
+        static QuadTreeAABB<T> quadrant(const QuadTreeAABB<T>& _Bounds, size_t _Index) {
+            const T left = (_Index == 0 || _Index == 3) ? _Bounds.left : _Bounds.x;
+            const T right = (_Index == 0 || _Index == 3) ? _Bounds.x : _Bounds.right;
+            const T top = _Index < 2 ? _Bounds.top : _Bounds.y;
+            const T bottom = _Index < 2 ? _Bounds.y : _Bounds.bottom;
+
+            return QuadTreeAABB<T>(left, top, right, bottom);
+        }
+
+        void assign_bounds(size_t _Shard, size_t _Level, const QuadTreeAABB<T>& _Bounds) {
+            if (_Level == depth) {
+                shards[_Shard].tree.set_bounds(_Bounds);
+                return;
+            }
+
+            for (size_t i = 0; i < kChildren; i++)
+                assign_bounds(_Shard * kChildren + i, _Level + 1, quadrant(_Bounds, i));
+        }
+
+        // locks two shards in index order so crossing moves cannot deadlock
+        struct PairLock {
+            std::unique_lock<std::shared_mutex> first, second;
+
+            PairLock(Shard& _A, Shard& _B, bool _AFirst) :
+                first(_AFirst ? _A.lock : _B.lock),
+                second(_AFirst ? _B.lock : _A.lock, std::defer_lock) {
+                if (&_A != &_B)
+                    second.lock();
+            }
+        };
+
+        size_t owner(size_t _Id) const {
+            std::shared_lock<std::shared_mutex> lock(owners_lock);
+
+            auto it = owners.find(_Id);
+            return it != owners.end() ? it->second : kInvalidShard;
+        }
+
+        void set_owner(size_t _Id, size_t _Shard) {
+            std::unique_lock<std::shared_mutex> lock(owners_lock);
+
+            if (_Shard == kInvalidShard)
+                owners.erase(_Id);
+            else
+                owners[_Id] = _Shard;
+        }
+
+        typedef std::vector<std::shared_lock<std::shared_mutex>> ReadLocks;
+
+        // read locks the shards whose max_bounds overlap _Boundaries, in
+        // index order like PairLock. objects moving between two of them
+        // wait for the readers, so each is seen in exactly one shard
+        ReadLocks lock_overlapping(const QuadTreeAABB<T>& _Boundaries, std::vector<size_t>& _Shards) const {
+            ReadLocks locks;
+
+            for (size_t i = 0; i < shard_count; i++) {
+                std::shared_lock<std::shared_mutex> lock(shards[i].lock);
+
+                if (shards[i].tree.get_max_bounds().intersects(_Boundaries)) {
+                    locks.push_back(std::move(lock));
+                    _Shards.push_back(i);
+                }
+            }
+
+            return locks;
+        }
+
+        bool move(size_t _From, const object_ptr& _Object, const QuadTreeAABB<T>& _Bounds);
+    public:
+        // _Depth 1 gives the four top-level quadrants, each further level
+        // multiplies the shard count by four
+        ShardedQuadTree(const QuadTreeAABB<T>& _Bounds, size_t _Depth = 1) :
+            bounds(_Bounds), depth(_Depth) {
+            for (size_t i = 0; i < _Depth; i++)
+                shard_count *= kChildren;
+
+            shards.reset(new Shard[shard_count]);
+            assign_bounds(0, 0, _Bounds);
+        }
+
+        ShardedQuadTree(const ShardedQuadTree&) = delete;
+        ShardedQuadTree& operator=(const ShardedQuadTree&) = delete;
+
+        const QuadTreeAABB<T>& get_bounds() const { return bounds; }
+
+        size_t get_shard_count() const { return shard_count; }
+
+        QuadTreeAABB<T> get_shard_bounds(size_t _Shard) const {
+            return shards[_Shard].tree.get_bounds();
+        }
+
+        // shard an object with _Bounds belongs to, descending into the first
+        // quadrant it intersects. kInvalidShard outside the root bounds
+        size_t shard_for(const QuadTreeAABB<T>& _Bounds) const {
+            if (!bounds.intersects(_Bounds))
+                return kInvalidShard;
+
+            const double x = ((double)_Bounds.left + (double)_Bounds.right) / 2.0;
+            const double y = ((double)_Bounds.top + (double)_Bounds.bottom) / 2.0;
+
+            QuadTreeAABB<T> region = bounds;
+            size_t shard = 0;
+
+            for (size_t level = 0; level < depth; level++) {
+                size_t next = kChildren;
+
+                for (size_t i = 0; i < kChildren && next == kChildren; i++) {
+                    if (quadrant(region, i).intersects(_Bounds))
+                        next = i;
+                }
+
+                // boxes without area on the center lines go by their center
+                if (next == kChildren) {
+                    if (y < (double)region.y)
+                        next = x < (double)region.x ? 0 : 1;
+                    else
+                        next = x < (double)region.x ? 3 : 2;
+                }
+
+                region = quadrant(region, next);
+                shard = shard * kChildren + next;
+            }
+
+            return shard;
+        }
+
+        // runs _Read(const tree_type&) on one shard under its read lock
+        template <typename _Func>
+        auto read_shard(size_t _Shard, _Func&& _Read) const {
+            std::shared_lock<std::shared_mutex> lock(shards[_Shard].lock);
+            return _Read(static_cast<const tree_type&>(shards[_Shard].tree));
+        }
+
+        // runs _Modify(tree_type&) on one shard under its write lock. the
+        // change must keep the objects of the shard inside its region, and
+        // objects inserted or removed this way bypass the id index
+        template <typename _Func>
+        auto modify_shard(size_t _Shard, _Func&& _Modify) {
+            std::unique_lock<std::shared_mutex> lock(shards[_Shard].lock);
+            return _Modify(shards[_Shard].tree);
+        }
+
+        // the id is claimed in the index first, so it stays unique even
+        // when inserted from two threads at once. a remove() of the id
+        // before the shard has the object fails and leaves the claim
+        bool insert(const object_ptr& _Object) {
+            const size_t shard = shard_for(_Object->bounds);
+            if (shard == kInvalidShard)
+                return false;
+
+            {
+                std::unique_lock<std::shared_mutex> lock(owners_lock);
+                if (!owners.emplace(_Object->id, shard).second)
+                    return false;
+            }
+
+            const bool inserted = modify_shard(shard, [&](tree_type& _Tree) { return _Tree.insert(_Object); });
+            if (!inserted)
+                set_owner(_Object->id, kInvalidShard);
+
+            return inserted;
+        }
+
+        // groups a range of object_ptr by shard and fills the shards on
+        // _Threads threads (all hardware threads when 0). returns the number
+        // of objects inserted
+        template <typename _Iterator>
+        size_t insert_batch(_Iterator _First, _Iterator _Last, size_t _Threads = 0);
+
+        bool remove(const object_ptr& _Object) {
+            return remove(_Object->id);
+        }
+
+        // the index entry is only dropped with the object. an id claimed by
+        // an insert that has not reached its shard yet stays claimed
+        bool remove(size_t _Id) {
+            // a move may take the object to another shard before the lock
+            for (;;) {
+                const size_t shard = owner(_Id);
+                if (shard == kInvalidShard)
+                    return false;
+
+                std::unique_lock<std::shared_mutex> lock(shards[shard].lock);
+                if (owner(_Id) != shard)
+                    continue;
+
+                if (!shards[shard].tree.remove(_Id))
+                    return false;
+
+                set_owner(_Id, kInvalidShard);
+                return true;
+            }
+        }
+
+        // moves the object to _Bounds. objects leaving their shard's route
+        // are moved to the new shard with both shards locked, readers see
+        // the object in exactly one of them. if _Bounds is outside the root
+        // the object is removed and false returned. updates of the same
+        // object must not run concurrently
+        bool update(const object_ptr& _Object, const QuadTreeAABB<T>& _Bounds) {
+            const size_t shard = shard_for(_Object->bounds);
+            if (shard == kInvalidShard)
+                return false;
+
+            return move(shard, _Object, _Bounds);
+        }
+
+        bool update(size_t _Id, const QuadTreeAABB<T>& _Bounds) {
+            const size_t shard = owner(_Id);
+            if (shard == kInvalidShard)
+                return false;
+
+            const object_ptr object = read_shard(shard, [&](const tree_type& _Tree) { return _Tree.find(_Id); });
+            return object && move(shard, object, _Bounds);
+        }
+
+        object_ptr find(size_t _Id) const {
+            const size_t shard = owner(_Id);
+            if (shard == kInvalidShard)
+                return nullptr;
+
+            return read_shard(shard, [&](const tree_type& _Tree) { return _Tree.find(_Id); });
+        }
+
+        // calls _Visit(const object_ptr&) or _Visit(const P&) for every
+        // object intersecting _Boundaries, shard by shard. the overlapping
+        // shards are read locked together for the whole query, so every
+        // object is visited exactly once. the visitor may return false to
+        // stop early, in which case query() returns false
+        template <typename _Visitor>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit) const {
+            std::vector<size_t> overlapping;
+            const ReadLocks locks = lock_overlapping(_Boundaries, overlapping);
+
+            for (size_t shard : overlapping) {
+                if (!shards[shard].tree.query(_Boundaries, _Visit))
+                    return false;
+            }
+
+            return true;
+        }
+
+        void query(const QuadTreeAABB<T>& _Boundaries, std::vector<object_ptr>& _Objects) const {
+            query(_Boundaries, [&](const object_ptr& _Object) {
+                _Objects.push_back(_Object);
+            });
+        }
+
+        // queries the overlapping shards on _Threads threads (all hardware
+        // threads when 0) and appends the results to _Objects in shard order.
+        // the shards stay locked together like in query()
+        void query_parallel(const QuadTreeAABB<T>& _Boundaries, std::vector<object_ptr>& _Objects,
+            size_t _Threads = 0) const;
+
+        // the _K objects closest to (_X, _Y) within _MaxRadius over all
+        // shards, see QuadTree::nearest(). shards are searched nearest
+        // first, each with the distance of the current k-th result as its
+        // radius, and their results merged. all shards are read locked for
+        // the search, so a moving object is not found twice
+        size_t nearest(T _X, T _Y, size_t _K, object_ptr* _Objects, double* _Distances,
+            double _MaxRadius = std::numeric_limits<double>::infinity()) const;
+
+        object_ptr nearest(T _X, T _Y,
+            double _MaxRadius = std::numeric_limits<double>::infinity()) const {
+            object_ptr object;
+            double distance;
+            nearest(_X, _Y, 1, &object, &distance, _MaxRadius);
+            return object;
+        }
+
+        size_t get_total_objects() const {
+            size_t total = 0;
+            for (size_t i = 0; i < shard_count; i++)
+                total += read_shard(i, [](const tree_type& _Tree) { return _Tree.get_total_objects(); });
+
+            return total;
+        }
+    };
+
+    template <typename T, size_t _Capacity, typename P, typename _Policy>
+    inline bool ShardedQuadTree<T, _Capacity, P, _Policy>::move(size_t _From,
+        const object_ptr& _Object, const QuadTreeAABB<T>& _Bounds)
+    {
+        const size_t to = shard_for(_Bounds);
+
+        if (to == _From)
+            return modify_shard(_From, [&](tree_type& _Tree) { return _Tree.update(_Object->id, _Bounds); });
+
+        if (to == kInvalidShard) {
+            std::unique_lock<std::shared_mutex> lock(shards[_From].lock);
+
+            if (shards[_From].tree.remove(_Object->id))
+                set_owner(_Object->id, kInvalidShard);
+            return false;
+        }
+
+        PairLock lock(shards[_From], shards[to], _From < to);
+
+        if (!shards[_From].tree.remove(_Object->id))
+            return false;
+
+        _Object->bounds = _Bounds;
+
+        const bool inserted = shards[to].tree.insert(_Object);
+        set_owner(_Object->id, inserted ? to : kInvalidShard);
+        return inserted;
+    }
+
+    template <typename T, size_t _Capacity, typename P, typename _Policy>
+    template <typename _Iterator>
+    inline size_t ShardedQuadTree<T, _Capacity, P, _Policy>::insert_batch(_Iterator _First, _Iterator _Last,
+        size_t _Threads)
+    {
+        std::vector<std::vector<object_ptr>> routed(shard_count);
+
+        {
+            // claims the ids up front like insert()
+            std::unique_lock<std::shared_mutex> lock(owners_lock);
+
+            for (; _First != _Last; ++_First) {
+                const object_ptr& object = *_First;
+                const size_t shard = shard_for(object->bounds);
+
+                if (shard != kInvalidShard && owners.emplace(object->id, shard).second)
+                    routed[shard].push_back(object);
+            }
+        }
+
+        std::atomic<size_t> inserted(0);
+        const size_t threads = _Threads ? _Threads : detail::default_threads();
+
+        // shards are filled in parallel, so each tree inserts on one thread
+        detail::parallel_for(shard_count, threads, [&](size_t _Shard) {
+            if (routed[_Shard].empty())
+                return;
+
+            inserted += modify_shard(_Shard, [&](tree_type& _Tree) {
+                return _Tree.insert_batch(routed[_Shard].begin(), routed[_Shard].end(), 1);
+            });
+        });
+
+        return inserted;
+    }
+
+    template <typename T, size_t _Capacity, typename P, typename _Policy>
+    inline void ShardedQuadTree<T, _Capacity, P, _Policy>::query_parallel(const QuadTreeAABB<T>& _Boundaries,
+        std::vector<object_ptr>& _Objects, size_t _Threads) const
+    {
+        std::vector<size_t> overlapping;
+        const ReadLocks locks = lock_overlapping(_Boundaries, overlapping);
+
+        std::vector<std::vector<object_ptr>> results(overlapping.size());
+        const size_t threads = _Threads ? _Threads : detail::default_threads();
+
+        // the workers only read, the locks held here cover them
+        detail::parallel_for(overlapping.size(), threads, [&](size_t _Task) {
+            shards[overlapping[_Task]].tree.query(_Boundaries, results[_Task]);
+        });
+
+        size_t total = _Objects.size();
+        for (const auto& result : results)
+            total += result.size();
+
+        _Objects.reserve(total);
+        for (const auto& result : results)
+            _Objects.insert(_Objects.end(), result.begin(), result.end());
+    }
+
+    template <typename T, size_t _Capacity, typename P, typename _Policy>
+    inline size_t ShardedQuadTree<T, _Capacity, P, _Policy>::nearest(T _X, T _Y, size_t _K,
+        object_ptr* _Objects, double* _Distances, double _MaxRadius) const
+    {
+        if (_K == 0)
+            return 0;
+
+        ReadLocks locks;
+        std::vector<std::pair<double, size_t>> order;
+
+        for (size_t i = 0; i < shard_count; i++) {
+            locks.emplace_back(shards[i].lock);
+
+            const QuadTreeBox<T> max_bounds(shards[i].tree.get_max_bounds());
+            order.emplace_back(std::sqrt(max_bounds.distance_squared(_X, _Y)), i);
+        }
+        std::sort(order.begin(), order.end());
+
+        std::vector<object_ptr> objects(_K);
+        std::vector<double> distances(_K);
+        size_t found = 0;
+
+        for (const auto& entry : order) {
+            // shards farther away than the current k-th result cannot improve it
+            const double limit = found == _K ? std::min(_MaxRadius, _Distances[found - 1]) : _MaxRadius;
+            if (entry.first > limit)
+                break;
+
+            const size_t count = shards[entry.second].tree.nearest(_X, _Y, _K,
+                objects.data(), distances.data(), limit);
+
+            // merges two sorted lists from the back, keeping the first _K
+            size_t a = found, b = count;
+            size_t total = std::min(_K, found + count);
+            while (a + b > total) {
+                if (a > 0 && (b == 0 || _Distances[a - 1] >= distances[b - 1]))
+                    a--;
+                else
+                    b--;
+            }
+
+            for (size_t slot = total; slot > 0; slot--) {
+                if (b == 0 || (a > 0 && _Distances[a - 1] > distances[b - 1])) {
+                    _Objects[slot - 1] = std::move(_Objects[a - 1]);
+                    _Distances[slot - 1] = _Distances[a - 1];
+                    a--;
+                }
+                else {
+                    _Objects[slot - 1] = std::move(objects[b - 1]);
+                    _Distances[slot - 1] = distances[b - 1];
+                    b--;
+                }
+            }
+
+            found = total;
+        }
+
+        return found;
+    }
+} // namespace nc
+
+#endif // NC_QUADTREE_SHARDED_H_
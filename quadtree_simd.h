@@ -0,0 +1,529 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_simd.h: batch box intersection kernels used by QuadTree leaf scans
+
+#ifndef NC_QUADTREE_SIMD_H_
+#define NC_QUADTREE_SIMD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__) \
+    || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define NC_QUADTREE_SIMD_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NC_QUADTREE_SIMD_NEON
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace nc {
+    namespace detail {
+        // number of boxes a single kernel call can report, one bit each
+        static constexpr size_t kMaskBits = 64;
+
+        inline unsigned count_trailing_zeros(uint64_t _Mask) {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward64(&index, _Mask);
+            return static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_ctzll(_Mask));
+#endif
+        }
+
+        // scalar reference kernel, sets bit i when box i intersects the query
+        template <typename T>
+        inline uint64_t intersect_mask_scalar(const T* _Left, const T* _Top,
+            const T* _Right, const T* _Bottom, size_t _Count,
+            T _QLeft, T _QTop, T _QRight, T _QBottom) {
+            uint64_t mask = 0;
+
+            for (size_t i = 0; i < _Count; i++) {
+                if (_Left[i] < _QRight && _Right[i] > _QLeft &&
+                    _Top[i] < _QBottom && _Bottom[i] > _QTop)
+                    mask |= (uint64_t)1 << i;
+            }
+
+            return mask;
+        }
+
+        // tests up to kMaskBits boxes stored as structure of arrays against
+        // a query box. generic version for types without a vector kernel
+        template <typename T>
+        inline uint64_t intersect_mask(const T* _Left, const T* _Top,
+            const T* _Right, const T* _Bottom, size_t _Count,
+            T _QLeft, T _QTop, T _QRight, T _QBottom) {
+            return intersect_mask_scalar(_Left, _Top, _Right, _Bottom, _Count,
+                _QLeft, _QTop, _QRight, _QBottom);
+        }
+
+        // lanes of the widest kernel available for T, 1 when only scalar
+        template <typename T>
+        constexpr size_t simd_lanes() { return 1; }
+
+#if defined(NC_QUADTREE_SIMD_X86)
+#if defined(__AVX512F__)
+        template <> constexpr size_t simd_lanes<float>() { return 16; }
+        template <> constexpr size_t simd_lanes<double>() { return 8; }
+#elif defined(__AVX__)
+        template <> constexpr size_t simd_lanes<float>() { return 8; }
+        template <> constexpr size_t simd_lanes<double>() { return 4; }
+#else
+        template <> constexpr size_t simd_lanes<float>() { return 4; }
+        template <> constexpr size_t simd_lanes<double>() { return 2; }
+#endif
+
+        template <>
+        inline uint64_t intersect_mask<float>(const float* _Left, const float* _Top,
+            const float* _Right, const float* _Bottom, size_t _Count,
+            float _QLeft, float _QTop, float _QRight, float _QBottom) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+#if defined(__AVX512F__)
+            const __m512 qleft = _mm512_set1_ps(_QLeft);
+            const __m512 qtop = _mm512_set1_ps(_QTop);
+            const __m512 qright = _mm512_set1_ps(_QRight);
+            const __m512 qbottom = _mm512_set1_ps(_QBottom);
+
+            for (; i + 16 <= _Count; i += 16) {
+                __mmask16 hit = _mm512_cmp_ps_mask(_mm512_loadu_ps(_Left + i), qright, _CMP_LT_OQ);
+                hit = _mm512_mask_cmp_ps_mask(hit, _mm512_loadu_ps(_Right + i), qleft, _CMP_GT_OQ);
+                hit = _mm512_mask_cmp_ps_mask(hit, _mm512_loadu_ps(_Top + i), qbottom, _CMP_LT_OQ);
+                hit = _mm512_mask_cmp_ps_mask(hit, _mm512_loadu_ps(_Bottom + i), qtop, _CMP_GT_OQ);
+                mask |= (uint64_t)hit << i;
+            }
+#elif defined(__AVX__)
+            const __m256 qleft = _mm256_set1_ps(_QLeft);
+            const __m256 qtop = _mm256_set1_ps(_QTop);
+            const __m256 qright = _mm256_set1_ps(_QRight);
+            const __m256 qbottom = _mm256_set1_ps(_QBottom);
+
+            for (; i + 8 <= _Count; i += 8) {
+                __m256 hit = _mm256_and_ps(
+                    _mm256_and_ps(
+                        _mm256_cmp_ps(_mm256_loadu_ps(_Left + i), qright, _CMP_LT_OQ),
+                        _mm256_cmp_ps(_mm256_loadu_ps(_Right + i), qleft, _CMP_GT_OQ)),
+                    _mm256_and_ps(
+                        _mm256_cmp_ps(_mm256_loadu_ps(_Top + i), qbottom, _CMP_LT_OQ),
+                        _mm256_cmp_ps(_mm256_loadu_ps(_Bottom + i), qtop, _CMP_GT_OQ)));
+                mask |= (uint64_t)_mm256_movemask_ps(hit) << i;
+            }
+#else
+            const __m128 qleft = _mm_set1_ps(_QLeft);
+            const __m128 qtop = _mm_set1_ps(_QTop);
+            const __m128 qright = _mm_set1_ps(_QRight);
+            const __m128 qbottom = _mm_set1_ps(_QBottom);
+
+            for (; i + 4 <= _Count; i += 4) {
+                __m128 hit = _mm_and_ps(
+                    _mm_and_ps(
+                        _mm_cmplt_ps(_mm_loadu_ps(_Left + i), qright),
+                        _mm_cmpgt_ps(_mm_loadu_ps(_Right + i), qleft)),
+                    _mm_and_ps(
+                        _mm_cmplt_ps(_mm_loadu_ps(_Top + i), qbottom),
+                        _mm_cmpgt_ps(_mm_loadu_ps(_Bottom + i), qtop)));
+                mask |= (uint64_t)_mm_movemask_ps(hit) << i;
+            }
+#endif
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+
+        template <>
+        inline uint64_t intersect_mask<double>(const double* _Left, const double* _Top,
+            const double* _Right, const double* _Bottom, size_t _Count,
+            double _QLeft, double _QTop, double _QRight, double _QBottom) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+#if defined(__AVX512F__)
+            const __m512d qleft = _mm512_set1_pd(_QLeft);
+            const __m512d qtop = _mm512_set1_pd(_QTop);
+            const __m512d qright = _mm512_set1_pd(_QRight);
+            const __m512d qbottom = _mm512_set1_pd(_QBottom);
+
+            for (; i + 8 <= _Count; i += 8) {
+                __mmask8 hit = _mm512_cmp_pd_mask(_mm512_loadu_pd(_Left + i), qright, _CMP_LT_OQ);
+                hit = _mm512_mask_cmp_pd_mask(hit, _mm512_loadu_pd(_Right + i), qleft, _CMP_GT_OQ);
+                hit = _mm512_mask_cmp_pd_mask(hit, _mm512_loadu_pd(_Top + i), qbottom, _CMP_LT_OQ);
+                hit = _mm512_mask_cmp_pd_mask(hit, _mm512_loadu_pd(_Bottom + i), qtop, _CMP_GT_OQ);
+                mask |= (uint64_t)hit << i;
+            }
+#elif defined(__AVX__)
+            const __m256d qleft = _mm256_set1_pd(_QLeft);
+            const __m256d qtop = _mm256_set1_pd(_QTop);
+            const __m256d qright = _mm256_set1_pd(_QRight);
+            const __m256d qbottom = _mm256_set1_pd(_QBottom);
+
+            for (; i + 4 <= _Count; i += 4) {
+                __m256d hit = _mm256_and_pd(
+                    _mm256_and_pd(
+                        _mm256_cmp_pd(_mm256_loadu_pd(_Left + i), qright, _CMP_LT_OQ),
+                        _mm256_cmp_pd(_mm256_loadu_pd(_Right + i), qleft, _CMP_GT_OQ)),
+                    _mm256_and_pd(
+                        _mm256_cmp_pd(_mm256_loadu_pd(_Top + i), qbottom, _CMP_LT_OQ),
+                        _mm256_cmp_pd(_mm256_loadu_pd(_Bottom + i), qtop, _CMP_GT_OQ)));
+                mask |= (uint64_t)_mm256_movemask_pd(hit) << i;
+            }
+#else
+            const __m128d qleft = _mm_set1_pd(_QLeft);
+            const __m128d qtop = _mm_set1_pd(_QTop);
+            const __m128d qright = _mm_set1_pd(_QRight);
+            const __m128d qbottom = _mm_set1_pd(_QBottom);
+
+            for (; i + 2 <= _Count; i += 2) {
+                __m128d hit = _mm_and_pd(
+                    _mm_and_pd(
+                        _mm_cmplt_pd(_mm_loadu_pd(_Left + i), qright),
+                        _mm_cmpgt_pd(_mm_loadu_pd(_Right + i), qleft)),
+                    _mm_and_pd(
+                        _mm_cmplt_pd(_mm_loadu_pd(_Top + i), qbottom),
+                        _mm_cmpgt_pd(_mm_loadu_pd(_Bottom + i), qtop)));
+                mask |= (uint64_t)_mm_movemask_pd(hit) << i;
+            }
+#endif
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+        // integer kernels compare signed lanes, unsigned coordinates are
+        // biased by the sign bit first so the order is kept
+#if defined(__AVX512F__)
+        template <> constexpr size_t simd_lanes<int32_t>() { return 16; }
+        template <> constexpr size_t simd_lanes<uint32_t>() { return 16; }
+#elif defined(__AVX2__)
+        template <> constexpr size_t simd_lanes<int32_t>() { return 8; }
+        template <> constexpr size_t simd_lanes<uint32_t>() { return 8; }
+#else
+        template <> constexpr size_t simd_lanes<int32_t>() { return 4; }
+        template <> constexpr size_t simd_lanes<uint32_t>() { return 4; }
+#endif
+
+#if defined(__AVX512BW__)
+        template <> constexpr size_t simd_lanes<uint16_t>() { return 32; }
+#elif defined(__AVX2__)
+        template <> constexpr size_t simd_lanes<uint16_t>() { return 16; }
+#else
+        template <> constexpr size_t simd_lanes<uint16_t>() { return 8; }
+#endif
+
+        template <typename T>
+        inline uint64_t intersect_mask_epi32(const T* _Left, const T* _Top,
+            const T* _Right, const T* _Bottom, size_t _Count,
+            T _QLeft, T _QTop, T _QRight, T _QBottom) {
+            static_assert(sizeof(T) == 4, "32-bit lanes");
+
+            const int32_t bias = std::is_signed<T>::value ? 0 : INT32_MIN;
+            uint64_t mask = 0;
+            size_t i = 0;
+
+#if defined(__AVX512F__)
+            const __m512i vbias = _mm512_set1_epi32(bias);
+            const __m512i qleft = _mm512_xor_si512(_mm512_set1_epi32((int32_t)_QLeft), vbias);
+            const __m512i qtop = _mm512_xor_si512(_mm512_set1_epi32((int32_t)_QTop), vbias);
+            const __m512i qright = _mm512_xor_si512(_mm512_set1_epi32((int32_t)_QRight), vbias);
+            const __m512i qbottom = _mm512_xor_si512(_mm512_set1_epi32((int32_t)_QBottom), vbias);
+
+            auto load = [&](const T* _Values) {
+                return _mm512_xor_si512(_mm512_loadu_si512(_Values), vbias);
+            };
+
+            for (; i + 16 <= _Count; i += 16) {
+                __mmask16 hit = _mm512_cmplt_epi32_mask(load(_Left + i), qright);
+                hit = _mm512_mask_cmpgt_epi32_mask(hit, load(_Right + i), qleft);
+                hit = _mm512_mask_cmplt_epi32_mask(hit, load(_Top + i), qbottom);
+                hit = _mm512_mask_cmpgt_epi32_mask(hit, load(_Bottom + i), qtop);
+                mask |= (uint64_t)hit << i;
+            }
+#elif defined(__AVX2__)
+            const __m256i vbias = _mm256_set1_epi32(bias);
+            const __m256i qleft = _mm256_xor_si256(_mm256_set1_epi32((int32_t)_QLeft), vbias);
+            const __m256i qtop = _mm256_xor_si256(_mm256_set1_epi32((int32_t)_QTop), vbias);
+            const __m256i qright = _mm256_xor_si256(_mm256_set1_epi32((int32_t)_QRight), vbias);
+            const __m256i qbottom = _mm256_xor_si256(_mm256_set1_epi32((int32_t)_QBottom), vbias);
+
+            auto load = [&](const T* _Values) {
+                return _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(_Values)), vbias);
+            };
+
+            for (; i + 8 <= _Count; i += 8) {
+                __m256i hit = _mm256_and_si256(
+                    _mm256_and_si256(
+                        _mm256_cmpgt_epi32(qright, load(_Left + i)),
+                        _mm256_cmpgt_epi32(load(_Right + i), qleft)),
+                    _mm256_and_si256(
+                        _mm256_cmpgt_epi32(qbottom, load(_Top + i)),
+                        _mm256_cmpgt_epi32(load(_Bottom + i), qtop)));
+                mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << i;
+            }
+#else
+            const __m128i vbias = _mm_set1_epi32(bias);
+            const __m128i qleft = _mm_xor_si128(_mm_set1_epi32((int32_t)_QLeft), vbias);
+            const __m128i qtop = _mm_xor_si128(_mm_set1_epi32((int32_t)_QTop), vbias);
+            const __m128i qright = _mm_xor_si128(_mm_set1_epi32((int32_t)_QRight), vbias);
+            const __m128i qbottom = _mm_xor_si128(_mm_set1_epi32((int32_t)_QBottom), vbias);
+
+            auto load = [&](const T* _Values) {
+                return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(_Values)), vbias);
+            };
+
+            for (; i + 4 <= _Count; i += 4) {
+                __m128i hit = _mm_and_si128(
+                    _mm_and_si128(
+                        _mm_cmplt_epi32(load(_Left + i), qright),
+                        _mm_cmpgt_epi32(load(_Right + i), qleft)),
+                    _mm_and_si128(
+                        _mm_cmplt_epi32(load(_Top + i), qbottom),
+                        _mm_cmpgt_epi32(load(_Bottom + i), qtop)));
+                mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(hit)) << i;
+            }
+#endif
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+
+        template <>
+        inline uint64_t intersect_mask<int32_t>(const int32_t* _Left, const int32_t* _Top,
+            const int32_t* _Right, const int32_t* _Bottom, size_t _Count,
+            int32_t _QLeft, int32_t _QTop, int32_t _QRight, int32_t _QBottom) {
+            return intersect_mask_epi32(_Left, _Top, _Right, _Bottom, _Count,
+                _QLeft, _QTop, _QRight, _QBottom);
+        }
+
+        template <>
+        inline uint64_t intersect_mask<uint32_t>(const uint32_t* _Left, const uint32_t* _Top,
+            const uint32_t* _Right, const uint32_t* _Bottom, size_t _Count,
+            uint32_t _QLeft, uint32_t _QTop, uint32_t _QRight, uint32_t _QBottom) {
+            return intersect_mask_epi32(_Left, _Top, _Right, _Bottom, _Count,
+                _QLeft, _QTop, _QRight, _QBottom);
+        }
+
+        template <>
+        inline uint64_t intersect_mask<uint16_t>(const uint16_t* _Left, const uint16_t* _Top,
+            const uint16_t* _Right, const uint16_t* _Bottom, size_t _Count,
+            uint16_t _QLeft, uint16_t _QTop, uint16_t _QRight, uint16_t _QBottom) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+#if defined(__AVX512BW__)
+            const __m512i qleft = _mm512_set1_epi16((short)_QLeft);
+            const __m512i qtop = _mm512_set1_epi16((short)_QTop);
+            const __m512i qright = _mm512_set1_epi16((short)_QRight);
+            const __m512i qbottom = _mm512_set1_epi16((short)_QBottom);
+
+            for (; i + 32 <= _Count; i += 32) {
+                __mmask32 hit = _mm512_cmplt_epu16_mask(_mm512_loadu_si512(_Left + i), qright);
+                hit = _mm512_mask_cmpgt_epu16_mask(hit, _mm512_loadu_si512(_Right + i), qleft);
+                hit = _mm512_mask_cmplt_epu16_mask(hit, _mm512_loadu_si512(_Top + i), qbottom);
+                hit = _mm512_mask_cmpgt_epu16_mask(hit, _mm512_loadu_si512(_Bottom + i), qtop);
+                mask |= (uint64_t)hit << i;
+            }
+#elif defined(__AVX2__)
+            const __m256i vbias = _mm256_set1_epi16(INT16_MIN);
+            const __m256i qleft = _mm256_xor_si256(_mm256_set1_epi16((short)_QLeft), vbias);
+            const __m256i qtop = _mm256_xor_si256(_mm256_set1_epi16((short)_QTop), vbias);
+            const __m256i qright = _mm256_xor_si256(_mm256_set1_epi16((short)_QRight), vbias);
+            const __m256i qbottom = _mm256_xor_si256(_mm256_set1_epi16((short)_QBottom), vbias);
+
+            auto load = [&](const uint16_t* _Values) {
+                return _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(_Values)), vbias);
+            };
+
+            for (; i + 16 <= _Count; i += 16) {
+                __m256i hit = _mm256_and_si256(
+                    _mm256_and_si256(
+                        _mm256_cmpgt_epi16(qright, load(_Left + i)),
+                        _mm256_cmpgt_epi16(load(_Right + i), qleft)),
+                    _mm256_and_si256(
+                        _mm256_cmpgt_epi16(qbottom, load(_Top + i)),
+                        _mm256_cmpgt_epi16(load(_Bottom + i), qtop)));
+
+                // narrow the 16-bit lanes to bytes to get one mask bit each
+                __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(hit), _mm256_extracti128_si256(hit, 1));
+                mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(bytes) << i;
+            }
+#else
+            const __m128i vbias = _mm_set1_epi16(INT16_MIN);
+            const __m128i qleft = _mm_xor_si128(_mm_set1_epi16((short)_QLeft), vbias);
+            const __m128i qtop = _mm_xor_si128(_mm_set1_epi16((short)_QTop), vbias);
+            const __m128i qright = _mm_xor_si128(_mm_set1_epi16((short)_QRight), vbias);
+            const __m128i qbottom = _mm_xor_si128(_mm_set1_epi16((short)_QBottom), vbias);
+
+            auto load = [&](const uint16_t* _Values) {
+                return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(_Values)), vbias);
+            };
+
+            for (; i + 8 <= _Count; i += 8) {
+                __m128i hit = _mm_and_si128(
+                    _mm_and_si128(
+                        _mm_cmplt_epi16(load(_Left + i), qright),
+                        _mm_cmpgt_epi16(load(_Right + i), qleft)),
+                    _mm_and_si128(
+                        _mm_cmplt_epi16(load(_Top + i), qbottom),
+                        _mm_cmpgt_epi16(load(_Bottom + i), qtop)));
+
+                __m128i bytes = _mm_packs_epi16(hit, _mm_setzero_si128());
+                mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(bytes) << i;
+            }
+#endif
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+#elif defined(NC_QUADTREE_SIMD_NEON)
+        template <> constexpr size_t simd_lanes<float>() { return 4; }
+
+        inline uint64_t neon_movemask(uint32x4_t _Hit) {
+            static const int32_t kShift[4] = { 0, 1, 2, 3 };
+            uint32x4_t bits = vshlq_u32(vshrq_n_u32(_Hit, 31), vld1q_s32(kShift));
+            return (uint64_t)(vgetq_lane_u32(bits, 0) | vgetq_lane_u32(bits, 1)
+                | vgetq_lane_u32(bits, 2) | vgetq_lane_u32(bits, 3));
+        }
+
+        template <>
+        inline uint64_t intersect_mask<float>(const float* _Left, const float* _Top,
+            const float* _Right, const float* _Bottom, size_t _Count,
+            float _QLeft, float _QTop, float _QRight, float _QBottom) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+            const float32x4_t qleft = vdupq_n_f32(_QLeft);
+            const float32x4_t qtop = vdupq_n_f32(_QTop);
+            const float32x4_t qright = vdupq_n_f32(_QRight);
+            const float32x4_t qbottom = vdupq_n_f32(_QBottom);
+
+            for (; i + 4 <= _Count; i += 4) {
+                uint32x4_t hit = vandq_u32(
+                    vandq_u32(
+                        vcltq_f32(vld1q_f32(_Left + i), qright),
+                        vcgtq_f32(vld1q_f32(_Right + i), qleft)),
+                    vandq_u32(
+                        vcltq_f32(vld1q_f32(_Top + i), qbottom),
+                        vcgtq_f32(vld1q_f32(_Bottom + i), qtop)));
+                mask |= neon_movemask(hit) << i;
+            }
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+
+        template <> constexpr size_t simd_lanes<int32_t>() { return 4; }
+        template <> constexpr size_t simd_lanes<uint32_t>() { return 4; }
+
+        // shared by the int32_t and uint32_t kernels, which only differ in
+        // how lanes are loaded and compared
+        template <typename T, typename _Dup, typename _Load, typename _Less>
+        inline uint64_t intersect_mask_neon32(const T* _Left, const T* _Top,
+            const T* _Right, const T* _Bottom, size_t _Count,
+            T _QLeft, T _QTop, T _QRight, T _QBottom, _Dup&& _Dp, _Load&& _Ld, _Less&& _Lt) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+            const auto qleft = _Dp(_QLeft);
+            const auto qtop = _Dp(_QTop);
+            const auto qright = _Dp(_QRight);
+            const auto qbottom = _Dp(_QBottom);
+
+            for (; i + 4 <= _Count; i += 4) {
+                uint32x4_t hit = vandq_u32(
+                    vandq_u32(_Lt(_Ld(_Left + i), qright), _Lt(qleft, _Ld(_Right + i))),
+                    vandq_u32(_Lt(_Ld(_Top + i), qbottom), _Lt(qtop, _Ld(_Bottom + i))));
+                mask |= neon_movemask(hit) << i;
+            }
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+
+        template <>
+        inline uint64_t intersect_mask<int32_t>(const int32_t* _Left, const int32_t* _Top,
+            const int32_t* _Right, const int32_t* _Bottom, size_t _Count,
+            int32_t _QLeft, int32_t _QTop, int32_t _QRight, int32_t _QBottom) {
+            return intersect_mask_neon32(_Left, _Top, _Right, _Bottom, _Count,
+                _QLeft, _QTop, _QRight, _QBottom,
+                [](int32_t _Value) { return vdupq_n_s32(_Value); },
+                [](const int32_t* _Values) { return vld1q_s32(_Values); },
+                [](int32x4_t _A, int32x4_t _B) { return vcltq_s32(_A, _B); });
+        }
+
+        template <>
+        inline uint64_t intersect_mask<uint32_t>(const uint32_t* _Left, const uint32_t* _Top,
+            const uint32_t* _Right, const uint32_t* _Bottom, size_t _Count,
+            uint32_t _QLeft, uint32_t _QTop, uint32_t _QRight, uint32_t _QBottom) {
+            return intersect_mask_neon32(_Left, _Top, _Right, _Bottom, _Count,
+                _QLeft, _QTop, _QRight, _QBottom,
+                [](uint32_t _Value) { return vdupq_n_u32(_Value); },
+                [](const uint32_t* _Values) { return vld1q_u32(_Values); },
+                [](uint32x4_t _A, uint32x4_t _B) { return vcltq_u32(_A, _B); });
+        }
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+        template <> constexpr size_t simd_lanes<double>() { return 2; }
+
+        template <>
+        inline uint64_t intersect_mask<double>(const double* _Left, const double* _Top,
+            const double* _Right, const double* _Bottom, size_t _Count,
+            double _QLeft, double _QTop, double _QRight, double _QBottom) {
+            uint64_t mask = 0;
+            size_t i = 0;
+
+            const float64x2_t qleft = vdupq_n_f64(_QLeft);
+            const float64x2_t qtop = vdupq_n_f64(_QTop);
+            const float64x2_t qright = vdupq_n_f64(_QRight);
+            const float64x2_t qbottom = vdupq_n_f64(_QBottom);
+
+            for (; i + 2 <= _Count; i += 2) {
+                uint64x2_t hit = vandq_u64(
+                    vandq_u64(
+                        vcltq_f64(vld1q_f64(_Left + i), qright),
+                        vcgtq_f64(vld1q_f64(_Right + i), qleft)),
+                    vandq_u64(
+                        vcltq_f64(vld1q_f64(_Top + i), qbottom),
+                        vcgtq_f64(vld1q_f64(_Bottom + i), qtop)));
+                mask |= ((vgetq_lane_u64(hit, 0) & 1) | ((vgetq_lane_u64(hit, 1) & 1) << 1)) << i;
+            }
+
+            if (i < _Count)
+                mask |= intersect_mask_scalar(_Left + i, _Top + i, _Right + i, _Bottom + i,
+                    _Count - i, _QLeft, _QTop, _QRight, _QBottom) << i;
+
+            return mask;
+        }
+#endif
+#endif
+    } // namespace detail
+} // namespace nc
+
+#endif // NC_QUADTREE_SIMD_H_
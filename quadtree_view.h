@@ -0,0 +1,442 @@
+// ================================= //
+//                                   //
+// QuadTree Version 0.1a             //
+// Copyright (c) 2017 NuclearC       //
+//                                   //
+// ================================= //
+
+// quadtree_view.h: on-disk format for built trees and a read-only view
+// that queries a memory-mapped file in place
+
+#ifndef NC_QUADTREE_VIEW_H_
+#define NC_QUADTREE_VIEW_H_
+
+#include "quadtree.h"
+
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+// keeps min/max macros and the rarely used headers out of includers
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nc {
+    namespace detail {
+        // file layout, all sections start on a 64 byte boundary:
+        //   ViewHeader
+        //   ViewNode[node_count], breadth first with siblings contiguous
+        //   T left[object_count], top[...], right[...], bottom[...]
+        //   uint64_t ids[object_count]
+        //   P payloads[object_count]
+        // each node owns the object range [first_object, first_object + object_count)
+        static constexpr char kViewMagic[8] = { 'N', 'C', 'Q', 'T', 'V', 'I', 'E', 'W' };
+        static constexpr uint32_t kViewVersion = 1;
+        static constexpr uint32_t kViewByteOrder = 0x01020304;
+        static constexpr size_t kViewAlignment = 64;
+
+        struct ViewHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+
+            // checked against the reading view's T and P
+            uint32_t coord_size;
+            uint32_t coord_kind;
+            uint32_t payload_size;
+            uint32_t node_count;
+
+            uint64_t object_count;
+            uint64_t file_size;
+        };
+
+        template <typename T>
+        struct ViewNode {
+            QuadTreeBox<T> bounds;
+            QuadTreeBox<T> max_bounds;
+
+            // first of four contiguous children, kInvalidView for leaves
+            uint32_t children;
+            uint32_t first_object;
+            uint32_t object_count;
+            uint32_t total_count;
+        };
+
+        static constexpr uint32_t kInvalidView = std::numeric_limits<uint32_t>::max();
+
+        template <typename T>
+        constexpr uint32_t coord_kind() {
+            return std::is_floating_point_v<T> ? 2 : (std::is_signed_v<T> ? 1 : 0);
+        }
+
+        inline size_t view_align(size_t _Offset) {
+            return (_Offset + kViewAlignment - 1) / kViewAlignment * kViewAlignment;
+        }
+
+        struct ViewLayout {
+            size_t nodes, left, top, right, bottom, ids, payloads, size;
+        };
+
+        template <typename T, typename P>
+        inline ViewLayout view_layout(size_t _NodeCount, size_t _ObjectCount) {
+            ViewLayout layout;
+
+            layout.nodes = view_align(sizeof(ViewHeader));
+            layout.left = view_align(layout.nodes + _NodeCount * sizeof(ViewNode<T>));
+            layout.top = view_align(layout.left + _ObjectCount * sizeof(T));
+            layout.right = view_align(layout.top + _ObjectCount * sizeof(T));
+            layout.bottom = view_align(layout.right + _ObjectCount * sizeof(T));
+            layout.ids = view_align(layout.bottom + _ObjectCount * sizeof(T));
+            layout.payloads = view_align(layout.ids + _ObjectCount * sizeof(uint64_t));
+            layout.size = layout.payloads + _ObjectCount * sizeof(P);
+            return layout;
+        }
+    } // namespace detail
+
+    // writes _Tree in the format read by QuadTreeView. payloads are copied
+    // bytewise, so pointer payloads are only meaningful within the process
+    // that wrote them. returns false if the file could not be written
+    template <typename T, size_t _Capacity, typename P, typename _Policy, typename _Allocator>
+    inline bool save_quadtree(const QuadTree<T, _Capacity, P, _Policy, _Allocator>& _Tree, const char* _Path) {
+        static_assert(std::is_trivially_copyable_v<P>, "payloads are stored bytewise");
+
+        typedef QuadTree<T, _Capacity, P, _Policy, _Allocator> tree_type;
+        typedef typename tree_type::node_index node_index;
+
+        // number the nodes breadth first so every sibling block stays contiguous
+        std::vector<node_index> order{ tree_type::kRootNode };
+        for (size_t i = 0; i < order.size(); i++) {
+            if (_Tree.has_children_(order[i])) {
+                for (node_index j = 0; j < 4; j++)
+                    order.push_back(_Tree.get_children(order[i]) + j);
+            }
+        }
+
+        if (order.size() >= detail::kInvalidView)
+            return false;
+
+        std::vector<detail::ViewNode<T>> nodes(order.size());
+        std::vector<T> left, top, right, bottom;
+        std::vector<uint64_t> ids;
+        std::vector<P> payloads;
+
+        for (size_t i = 0, next_child = 1; i < order.size(); i++) {
+            detail::ViewNode<T>& node = nodes[i];
+
+            node.bounds = _Tree.get_bounds(order[i]);
+            node.max_bounds = _Tree.get_max_bounds(order[i]);
+            node.first_object = static_cast<uint32_t>(ids.size());
+            node.object_count = static_cast<uint32_t>(_Tree.get_object_count(order[i]));
+            node.total_count = 0;
+            node.children = detail::kInvalidView;
+
+            if (_Tree.has_children_(order[i])) {
+                node.children = static_cast<uint32_t>(next_child);
+                next_child += 4;
+            }
+
+            _Tree.visit_objects(order[i], [&](const typename tree_type::object_ptr& _Object) {
+                left.push_back(_Object->bounds.left);
+                top.push_back(_Object->bounds.top);
+                right.push_back(_Object->bounds.right);
+                bottom.push_back(_Object->bounds.bottom);
+                ids.push_back(_Object->id);
+                payloads.push_back(_Object->user_data);
+            });
+        }
+
+        // subtree totals bottom-up, children always come after their parent
+        for (size_t i = nodes.size(); i-- > 0;) {
+            nodes[i].total_count += nodes[i].object_count;
+
+            if (nodes[i].children != detail::kInvalidView) {
+                for (size_t j = 0; j < 4; j++)
+                    nodes[i].total_count += nodes[nodes[i].children + j].total_count;
+            }
+        }
+
+        if (ids.size() >= detail::kInvalidView)
+            return false;
+
+        const detail::ViewLayout layout = detail::view_layout<T, P>(nodes.size(), ids.size());
+
+        detail::ViewHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, detail::kViewMagic, sizeof(header.magic));
+        header.version = detail::kViewVersion;
+        header.byte_order = detail::kViewByteOrder;
+        header.coord_size = sizeof(T);
+        header.coord_kind = detail::coord_kind<T>();
+        header.payload_size = sizeof(P);
+        header.node_count = static_cast<uint32_t>(nodes.size());
+        header.object_count = ids.size();
+        header.file_size = layout.size;
+
+        std::vector<char> image(layout.size, 0);
+
+        auto put = [&](size_t _Offset, const void* _Data, size_t _Size) {
+            if (_Size > 0)
+                std::memcpy(image.data() + _Offset, _Data, _Size);
+        };
+
+        put(0, &header, sizeof(header));
+        put(layout.nodes, nodes.data(), nodes.size() * sizeof(detail::ViewNode<T>));
+        put(layout.left, left.data(), left.size() * sizeof(T));
+        put(layout.top, top.data(), top.size() * sizeof(T));
+        put(layout.right, right.data(), right.size() * sizeof(T));
+        put(layout.bottom, bottom.data(), bottom.size() * sizeof(T));
+        put(layout.ids, ids.data(), ids.size() * sizeof(uint64_t));
+        put(layout.payloads, payloads.data(), payloads.size() * sizeof(P));
+
+        std::ofstream file(_Path, std::ios::binary | std::ios::trunc);
+        file.write(image.data(), (std::streamsize)image.size());
+        return static_cast<bool>(file);
+    }
+
+    // read-only tree over a file written by save_quadtree(). the file is
+    // mapped and queried in place, so opening is constant time and
+    // processes mapping the same file share its pages
+    template <typename T = double, typename P = void*>
+    class QuadTreeView {
+    public:
+        QuadTreeView() {}
+        ~QuadTreeView() { close(); }
+
+        QuadTreeView(const QuadTreeView&) = delete;
+        QuadTreeView& operator=(const QuadTreeView&) = delete;
+
+        // maps _Path, returns false if it cannot be mapped or does not hold
+        // a tree of this T and P
+        bool open(const char* _Path);
+
+        // uses a caller owned image, which must stay alive and 64 byte aligned
+        bool open(const void* _Data, size_t _Size) {
+            close();
+            return attach(_Data, _Size);
+        }
+
+        void close();
+
+        bool is_open() const { return nodes != nullptr; }
+
+        // calls _Visit(size_t id, const P& payload) for every object
+        // intersecting _Boundaries, a visitor returning false stops the query
+        template <typename _Visitor>
+        bool query(const QuadTreeAABB<T>& _Boundaries, _Visitor&& _Visit) const {
+            return is_open() ? query(0, _Boundaries, _Visit) : true;
+        }
+
+        void query(const QuadTreeAABB<T>& _Boundaries, std::vector<size_t>& _Ids) const {
+            query(_Boundaries, [&](size_t _Id, const P&) { _Ids.push_back(_Id); });
+        }
+
+        QuadTreeAABB<T> get_bounds() const { return nodes[0].bounds.to_aabb(); }
+        size_t get_node_count() const { return node_count; }
+        size_t get_total_objects() const { return node_count ? nodes[0].total_count : 0; }
+    private:
+        const detail::ViewNode<T>* nodes = nullptr;
+        const T* object_left = nullptr;
+        const T* object_top = nullptr;
+        const T* object_right = nullptr;
+        const T* object_bottom = nullptr;
+        const uint64_t* ids = nullptr;
+        const P* payloads = nullptr;
+        size_t node_count = 0;
+
+        // mapping owned by the view, if any
+        const void* mapping = nullptr;
+        size_t mapping_size = 0;
+#if defined(_WIN32)
+        HANDLE mapping_handle = nullptr;
+#endif
+
+        bool attach(const void* _Data, size_t _Size);
+
+        template <typename _Visitor>
+        bool query(uint32_t _Node, const QuadTreeAABB<T>& _Bounds, _Visitor& _Visit) const;
+    };
+
+    template <typename T, typename P>
+    inline bool QuadTreeView<T, P>::attach(const void* _Data, size_t _Size)
+    {
+        const char* base = static_cast<const char*>(_Data);
+
+        if (_Size < sizeof(detail::ViewHeader) || reinterpret_cast<uintptr_t>(base) % detail::kViewAlignment)
+            return false;
+
+        detail::ViewHeader header;
+        std::memcpy(&header, base, sizeof(header));
+
+        if (std::memcmp(header.magic, detail::kViewMagic, sizeof(header.magic)) != 0
+            || header.version != detail::kViewVersion
+            || header.byte_order != detail::kViewByteOrder
+            || header.coord_size != sizeof(T)
+            || header.coord_kind != detail::coord_kind<T>()
+            || header.payload_size != sizeof(P)
+            || header.node_count == 0
+            || header.file_size != _Size
+            || header.object_count > _Size)
+            return false;
+
+        const detail::ViewLayout layout = detail::view_layout<T, P>(header.node_count, header.object_count);
+        if (layout.size != _Size)
+            return false;
+
+        const detail::ViewNode<T>* image = reinterpret_cast<const detail::ViewNode<T>*>(base + layout.nodes);
+
+        // queries trust the node table, so a damaged file must not send them
+        // outside it. children always come after their parent, which also
+        // rules out cycles
+        for (size_t i = 0; i < header.node_count; i++) {
+            const detail::ViewNode<T>& node = image[i];
+
+            if (node.children != detail::kInvalidView
+                && (node.children <= i || (uint64_t)node.children + 4 > header.node_count))
+                return false;
+
+            if ((uint64_t)node.first_object + node.object_count > header.object_count)
+                return false;
+        }
+
+        nodes = image;
+        object_left = reinterpret_cast<const T*>(base + layout.left);
+        object_top = reinterpret_cast<const T*>(base + layout.top);
+        object_right = reinterpret_cast<const T*>(base + layout.right);
+        object_bottom = reinterpret_cast<const T*>(base + layout.bottom);
+        ids = reinterpret_cast<const uint64_t*>(base + layout.ids);
+        payloads = reinterpret_cast<const P*>(base + layout.payloads);
+        node_count = header.node_count;
+        return true;
+    }
+
+    template <typename T, typename P>
+    inline bool QuadTreeView<T, P>::open(const char* _Path)
+    {
+        close();
+
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(_Path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping_handle)
+            return false;
+
+        mapping = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (!mapping) {
+            CloseHandle(mapping_handle);
+            mapping_handle = nullptr;
+            return false;
+        }
+
+        mapping_size = static_cast<size_t>(size.QuadPart);
+#else
+        int file = ::open(_Path, O_RDONLY);
+        if (file < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size == 0) {
+            ::close(file);
+            return false;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+        ::close(file);
+        if (data == MAP_FAILED)
+            return false;
+
+        mapping = data;
+        mapping_size = static_cast<size_t>(info.st_size);
+#endif
+
+        if (!attach(mapping, mapping_size)) {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    template <typename T, typename P>
+    inline void QuadTreeView<T, P>::close()
+    {
+        if (mapping) {
+#if defined(_WIN32)
+            UnmapViewOfFile(mapping);
+            CloseHandle(mapping_handle);
+            mapping_handle = nullptr;
+#else
+            munmap(const_cast<void*>(mapping), mapping_size);
+#endif
+            mapping = nullptr;
+            mapping_size = 0;
+        }
+
+        nodes = nullptr;
+        object_left = object_top = object_right = object_bottom = nullptr;
+        ids = nullptr;
+        payloads = nullptr;
+        node_count = 0;
+    }
+
+    template <typename T, typename P>
+    template <typename _Visitor>
+    inline bool QuadTreeView<T, P>::query(uint32_t _Node, const QuadTreeAABB<T>& _Bounds,
+        _Visitor& _Visit) const
+    {
+        const detail::ViewNode<T>& node = nodes[_Node];
+
+        if (node.total_count == 0 || !node.max_bounds.intersects(_Bounds))
+            return true;
+
+        if (node.children != detail::kInvalidView) {
+            for (uint32_t i = 0; i < 4; i++) {
+                if (!query(node.children + i, _Bounds, _Visit))
+                    return false;
+            }
+        }
+
+        // objects of a node are contiguous, so they go through the same
+        // batch kernel as the leaves of a live tree
+        for (size_t base = node.first_object, end = base + node.object_count; base < end;
+            base += detail::kMaskBits) {
+            uint64_t mask = detail::intersect_mask(object_left + base, object_top + base,
+                object_right + base, object_bottom + base,
+                std::min<size_t>(detail::kMaskBits, end - base),
+                _Bounds.left, _Bounds.top, _Bounds.right, _Bounds.bottom);
+
+            while (mask) {
+                const size_t i = base + detail::count_trailing_zeros(mask);
+                mask &= mask - 1;
+
+                if (!detail::visit(_Visit, static_cast<size_t>(ids[i]), payloads[i]))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+} // namespace nc
+
+#endif // NC_QUADTREE_VIEW_H_